@@ -0,0 +1,44 @@
+/*
+ * backend.c - Registry of the allocators linked into the driver
+ *
+ * The backends are kept in a list sorted by name, so the order does
+ * not depend on the order the constructors happen to run in.
+ */
+#include <string.h>
+#include "backend.h"
+
+static backend_t *backends = NULL; /* the registered backends */
+
+/*
+ * backend_register - add a backend to the registry
+ */
+void backend_register(backend_t *b)
+{
+    backend_t **p = &backends;
+
+    while (*p != NULL && strcmp((*p)->name, b->name) < 0)
+	p = &(*p)->next;
+    b->next = *p;
+    *p = b;
+}
+
+/*
+ * backend_find - return the backend registered under name
+ */
+backend_t *backend_find(const char *name)
+{
+    backend_t *b;
+
+    for (b = backends; b != NULL; b = b->next)
+	if (!strcmp(b->name, name))
+	    return b;
+    return NULL;
+}
+
+/*
+ * backend_list - return the first registered backend
+ */
+backend_t *backend_list(void)
+{
+    return backends;
+}
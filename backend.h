@@ -0,0 +1,55 @@
+/*
+ * backend.h - Registry of the allocators linked into the driver
+ *
+ * Every mm-*.c file registers its malloc package under a name with
+ * MM_BACKEND, so one driver binary can evaluate several allocators
+ * side by side. The files define the usual mm_* functions; the
+ * Makefile renames them when more than one is linked in.
+ */
+#include <stddef.h>
+
+struct heapstats;
+
+typedef struct backend_t {
+    char *name;                               /* name given to mdriver -b */
+    int (*init)(void);
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+    void (*checkheap)(int verbose);           /* NULL if there is none */
+    int (*malloc_batch)(size_t size, void **ptrs, int n); /* NULL if there is none... */
+    void (*free_batch)(void **ptrs, int n);   /* ... else the driver loops */
+    void (*free_sized)(void *ptr, size_t size); /* NULL if there is none... */
+    void *(*realloc_sized)(void *ptr, size_t oldsize, size_t size); /* ... too */
+    void *(*memalign)(size_t align, size_t size); /* NULL if there is none */
+    void (*heapstats)(struct heapstats *stats); /* NULL if there is none */
+    struct backend_t *next;                   /* next registered backend */
+} backend_t;
+
+/* Add a backend to the registry, called before main by MM_BACKEND */
+void backend_register(backend_t *b);
+
+/* Return the backend registered under name, NULL if there is none */
+backend_t *backend_find(const char *name);
+
+/* Return the first registered backend, the others follow its next links */
+backend_t *backend_list(void);
+
+/* Register the functions of the including file as backend name */
+#define MM_BACKEND(name, init_fn, malloc_fn, free_fn, realloc_fn, checkheap_fn) \
+    MM_BACKEND_EXT(name, init_fn, malloc_fn, free_fn, realloc_fn, \
+		   checkheap_fn, NULL, NULL, NULL, NULL, NULL, NULL)
+
+/* The same for a package that has the batch, sized, aligned and heap statistics entry points */
+#define MM_BACKEND_EXT(name, init_fn, malloc_fn, free_fn, realloc_fn, \
+		       checkheap_fn, malloc_batch_fn, free_batch_fn, \
+		       free_sized_fn, realloc_sized_fn, memalign_fn, \
+		       heapstats_fn) \
+    static backend_t mm_backend = \
+	{name, init_fn, malloc_fn, free_fn, realloc_fn, checkheap_fn, \
+	 malloc_batch_fn, free_batch_fn, free_sized_fn, realloc_sized_fn, \
+	 memalign_fn, heapstats_fn, NULL}; \
+    static void __attribute__((constructor)) mm_backend_register(void) \
+    { \
+	backend_register(&mm_backend); \
+    }
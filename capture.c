@@ -0,0 +1,748 @@
+/*
+ * capture.c - Record the malloc requests of a running program as a
+ *             binary trace, for mdriver to replay
+ *
+ * Build libcapture.so and preload it:
+ *
+ *     LD_PRELOAD=./libcapture.so MM_CAPTURE_FILE=app.bin ./app
+ *
+ * malloc, calloc, realloc, free and the aligned allocation functions
+ * are interposed. A request is only appended to a ring buffer of the
+ * calling thread, the rings are single producer, single consumer and
+ * need no locks. A background flusher thread drains them, merges the
+ * requests back into one global order, maps every live pointer to the
+ * dense ids read_trace() expects and writes the trace file. When a ring
+ * is full its thread waits for the flusher rather than dropping a
+ * request, so the trace is always complete.
+ *
+ * The global order comes from a sequence number every request takes
+ * with one atomic increment. Frees take theirs before the block is
+ * given back and allocations after they got it, so a block that is
+ * freed and handed out again by another thread is seen in that order.
+ * A realloc can still race with another thread over the block it gives
+ * up; the flusher frees the stale id when it sees an address handed
+ * out twice and counts it as a fixup.
+ *
+ * Environment:
+ *     MM_CAPTURE_FILE   trace to write, %p is replaced by the process
+ *                       id (default capture.%p.bin)
+ *     MM_CAPTURE_RING   requests per thread ring, a power of 2 (65536)
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "trace.h"
+
+#define RING_SIZE     (1 << 16)   /* default requests per ring */
+#define BOOT_SIZE     (1 << 16)   /* bytes handed out while dlsym runs */
+#define FLUSH_NSECS   1000000     /* flusher sleeps this long when idle */
+#define OUT_BATCH     4096        /* trace records written at a time */
+#define MAP_MIN       (1 << 16)   /* initial slots of the pointer map */
+#define MIN_ALIGN     16          /* alignment mdriver gives every block */
+
+#define TLS __thread __attribute__((tls_model("initial-exec")))
+
+/* One intercepted request */
+typedef struct {
+    unsigned long seq;      /* position in the global order */
+    int type;               /* ALLOC, ALLOC_ALIGNED, FREE or REALLOC */
+    void *ptr;              /* block returned, or freed */
+    void *old;              /* block given to realloc, or the alignment */
+    size_t size;            /* requested size */
+} event_t;
+
+/* The ring of one thread, the owner writes head and the flusher tail */
+typedef struct ring {
+    event_t *events;
+    unsigned long mask;     /* ring size - 1 */
+    volatile unsigned long head; /* next event the owner writes */
+    volatile unsigned long tail; /* next event the flusher reads */
+    volatile int owned;     /* a live thread writes to this ring */
+    struct ring *next;      /* all rings ever made */
+} ring_t;
+
+/* An entry of the pointer to id map */
+typedef struct {
+    void *ptr;              /* NULL if the slot is empty */
+    unsigned int id;
+} slot_t;
+
+/* The real allocator */
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+static void *(*real_aligned_alloc)(size_t, size_t);
+static void *(*real_memalign)(size_t, size_t);
+
+/* Shared between the threads */
+static ring_t *volatile rings;        /* list of all rings */
+static volatile unsigned long next_seq; /* the next sequence number */
+static volatile int capturing;        /* set once the flusher runs */
+static volatile int stopping;         /* tells the flusher to finish */
+static volatile int starting;         /* someone is starting the flusher */
+static pthread_t flusher;
+static unsigned long ring_size = RING_SIZE;
+static pthread_key_t ring_key;        /* gives up the ring at thread exit */
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+
+/* Per thread */
+static TLS ring_t *my_ring;           /* ring of the calling thread */
+static TLS int in_hook;               /* the thread is inside the shim */
+
+/* 
+ * Bootstrap memory, used while dlsym looks up the real allocator. Each
+ * block is preceded by BOOT_HDR bytes that hold its size, for realloc.
+ */
+#define BOOT_HDR 16
+static char boot_buf[BOOT_SIZE] __attribute__((aligned(16)));
+static size_t boot_used;
+
+/* Owned by the flusher */
+static unsigned long order_seq;       /* next sequence number to write */
+static slot_t *map;                   /* live pointers to their ids */
+static unsigned long map_size, map_used;
+static unsigned int num_ids;
+static traceop_t out[OUT_BATCH];
+static int num_out;
+static unsigned long num_ops, fixups, unknown;
+static FILE *tracefile;
+static char path[4096];
+
+/* Function prototypes */
+static void init_real(void);
+static void start_capture(void);
+static void record(int type, void *ptr, void *old, size_t size,
+		   unsigned long seq);
+static void record_aligned(void *ptr, size_t alignment, size_t size);
+static ring_t *get_ring(void);
+static void make_key(void);
+static void ring_release(void *arg);
+static void *flush_thread(void *arg);
+static unsigned long drain(int all);
+static void handle(event_t *e);
+static void emit(int type, unsigned int id, size_t size, unsigned int count);
+static void flush_out(void);
+static unsigned int *map_find(void *ptr);
+static void map_put(void *ptr, unsigned int id);
+static void map_del(void *ptr);
+static void stop_capture(void);
+static void child_after_fork(void);
+
+/*********************************
+ * The interposed functions
+ *********************************/
+
+void *malloc(size_t size)
+{
+    void *p;
+
+    if (real_malloc == NULL)
+	init_real();
+    if (in_hook || !capturing) {
+	if (real_malloc == NULL) { /* dlsym itself is allocating */
+	    if (size > BOOT_SIZE ||
+		boot_used + BOOT_HDR + ((size + 15) & ~(size_t)15) > BOOT_SIZE)
+		return NULL;
+	    p = boot_buf + boot_used + BOOT_HDR;
+	    *(size_t *)((char *)p - BOOT_HDR) = size;
+	    boot_used += BOOT_HDR + ((size + 15) & ~(size_t)15);
+	    return p;
+	}
+	if (!in_hook)
+	    start_capture();
+	if (in_hook || !capturing)
+	    return real_malloc(size);
+    }
+    p = real_malloc(size);
+    if (p != NULL)
+	record(ALLOC, p, NULL, size, 0);
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (real_calloc == NULL) {
+	/* dlsym may ask for zeroed memory, boot_buf is zeroed already */
+	init_real();
+	if (real_calloc == NULL)
+	    return malloc(nmemb * size);
+    }
+    if (in_hook || !capturing) {
+	if (!in_hook)
+	    start_capture();
+	if (in_hook || !capturing)
+	    return real_calloc(nmemb, size);
+    }
+    p = real_calloc(nmemb, size);
+    if (p != NULL)
+	record(ALLOC, p, NULL, nmemb * size, 0);
+    return p;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    unsigned long seq;
+    size_t old_size;
+    void *p;
+
+    if (real_realloc == NULL)
+	init_real();
+    if ((char *)ptr >= boot_buf && (char *)ptr < boot_buf + BOOT_SIZE) {
+	/* a bootstrap block moves into the real heap, with no more than it holds */
+	old_size = *(size_t *)((char *)ptr - BOOT_HDR);
+	if ((p = malloc(size)) != NULL)
+	    memcpy(p, ptr, old_size < size ? old_size : size);
+	return p;
+    }
+    if (in_hook || !capturing) {
+	if (!in_hook)
+	    start_capture();
+	if (in_hook || !capturing)
+	    return real_realloc(ptr, size);
+    }
+
+    /* 
+     * Like a free, the old block may be handed out once we call realloc,
+     * so the number is taken first. The ring is secured before, a number
+     * that is never written would stop the flusher at the gap for good.
+     */
+    if (my_ring == NULL && get_ring() == NULL)
+	return real_realloc(ptr, size);
+    seq = __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+    p = real_realloc(ptr, size);
+    if (p != NULL || size == 0)
+	record(REALLOC, p, ptr, size, seq + 1);
+    else
+	record(REALLOC, ptr, ptr, 0, seq + 1); /* failed, nothing changed */
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL ||
+	((char *)ptr >= boot_buf && (char *)ptr < boot_buf + BOOT_SIZE))
+	return;
+    if (real_free == NULL)
+	init_real();
+    if (!in_hook && capturing)
+	record(FREE, ptr, NULL, 0, 0);
+    real_free(ptr);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    int ret;
+
+    if (real_posix_memalign == NULL)
+	init_real();
+    if (!in_hook && !capturing)
+	start_capture();
+    ret = real_posix_memalign(memptr, alignment, size);
+    if (ret == 0 && !in_hook && capturing)
+	record_aligned(*memptr, alignment, size);
+    return ret;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    void *p;
+
+    if (real_aligned_alloc == NULL)
+	init_real();
+    if (!in_hook && !capturing)
+	start_capture();
+    p = real_aligned_alloc(alignment, size);
+    if (p != NULL && !in_hook && capturing)
+	record_aligned(p, alignment, size);
+    return p;
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    void *p;
+
+    if (real_memalign == NULL)
+	init_real();
+    if (!in_hook && !capturing)
+	start_capture();
+    p = real_memalign(alignment, size);
+    if (p != NULL && !in_hook && capturing)
+	record_aligned(p, alignment, size);
+    return p;
+}
+
+/*********************************
+ * The recording side
+ *********************************/
+
+/*
+ * init_real - look up the real allocator, dlsym may call malloc and
+ *     calloc which are served from boot_buf meanwhile
+ */
+static void init_real(void)
+{
+    static volatile int looking = 0;
+
+    if (looking)
+	return;
+    looking = 1;
+    real_free = dlsym(RTLD_NEXT, "free");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+    real_aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+    real_memalign = dlsym(RTLD_NEXT, "memalign");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    if (real_malloc == NULL || real_calloc == NULL || real_realloc == NULL ||
+	real_free == NULL) {
+	fprintf(stderr, "capture: could not find the real malloc\n");
+	abort();
+    }
+}
+
+/*
+ * start_capture - open the trace and start the flusher, done by the
+ *     first thread that makes a request
+ */
+static void start_capture(void)
+{
+    char *env;
+    size_t i;
+
+    if (capturing || stopping ||
+	__atomic_exchange_n(&starting, 1, __ATOMIC_ACQUIRE))
+	return;
+
+    in_hook = 1;
+    if ((env = getenv("MM_CAPTURE_RING")) != NULL && atol(env) > 0)
+	for (ring_size = 2; ring_size < (unsigned long)atol(env); ring_size *= 2)
+	    ;
+    if ((env = getenv("MM_CAPTURE_FILE")) == NULL)
+	env = "capture.%p.bin";
+    for (i = 0; *env != '\0' && i < sizeof(path) - 16; env++)
+	if (env[0] == '%' && env[1] == 'p') {
+	    i += sprintf(path + i, "%d", (int)getpid());
+	    env++;
+	}
+	else
+	    path[i++] = *env;
+    path[i] = '\0';
+
+    if ((tracefile = fopen(path, "w")) == NULL) {
+	fprintf(stderr, "capture: could not create %s: %s\n", path,
+		strerror(errno));
+	in_hook = 0;
+	return;
+    }
+    /* room for the header, which is written at the end */
+    fseek(tracefile, sizeof(trace_hdr_t), SEEK_SET);
+
+    if (pthread_create(&flusher, NULL, flush_thread, NULL) != 0) {
+	fprintf(stderr, "capture: could not start the flusher\n");
+	fclose(tracefile);
+	in_hook = 0;
+	return;
+    }
+    pthread_atfork(NULL, NULL, child_after_fork);
+    atexit(stop_capture);
+    __atomic_store_n(&capturing, 1, __ATOMIC_RELEASE);
+    in_hook = 0;
+}
+
+/*
+ * record - append a request to the ring of the calling thread, seq is
+ *     the sequence number + 1 if the caller took one already, which it
+ *     only may once the thread has a ring
+ */
+static void record(int type, void *ptr, void *old, size_t size,
+		   unsigned long seq)
+{
+    ring_t *r = my_ring;
+    event_t *e;
+    unsigned long head;
+
+    if (r == NULL && (r = get_ring()) == NULL)
+	return;
+
+    head = r->head;
+    while (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) > r->mask) {
+	if (stopping)      /* the flusher is gone, drop the request */
+	    return;
+	sched_yield();     /* full, wait for the flusher */
+    }
+
+    e = &r->events[head & r->mask];
+    e->seq = seq ? seq - 1 : __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+    e->type = type;
+    e->ptr = ptr;
+    e->old = old;
+    e->size = size;
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * record_aligned - record an aligned alloc, with its alignment rounded
+ *     up to a power of two. One the driver gives every block anyway
+ *     is recorded as a plain alloc.
+ */
+static void record_aligned(void *ptr, size_t alignment, size_t size)
+{
+    size_t align = MIN_ALIGN;
+
+    if (alignment <= MIN_ALIGN) {
+	record(ALLOC, ptr, NULL, size, 0);
+	return;
+    }
+    while (align < alignment)
+	align <<= 1;
+    record(ALLOC_ALIGNED, ptr, (void *)align, size, 0);
+}
+
+/*
+ * get_ring - give the calling thread a ring, an abandoned one if there
+ *     is one, and make sure it is given up when the thread exits
+ */
+static ring_t *get_ring(void)
+{
+    ring_t *r;
+
+    in_hook = 1;
+    for (r = rings; r != NULL; r = r->next)
+	if (!r->owned && __atomic_exchange_n(&r->owned, 1, __ATOMIC_ACQUIRE) == 0)
+	    break;
+
+    if (r == NULL) {
+	r = mmap(NULL, sizeof(ring_t) + ring_size * sizeof(event_t),
+		 PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (r == MAP_FAILED) {
+	    in_hook = 0;
+	    return NULL;
+	}
+	r->events = (event_t *)(r + 1);
+	r->mask = ring_size - 1;
+	r->owned = 1;
+	do
+	    r->next = rings;
+	while (!__atomic_compare_exchange_n(&rings, &r->next, r, 0,
+					    __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+
+    pthread_once(&ring_once, make_key);
+    pthread_setspecific(ring_key, r);
+    my_ring = r;
+    in_hook = 0;
+    return r;
+}
+
+/* the key is only used for its destructor */
+static void make_key(void)
+{
+    pthread_key_create(&ring_key, ring_release);
+}
+
+/*
+ * ring_release - an exiting thread gives up its ring, the flusher still
+ *     drains what is left in it
+ */
+static void ring_release(void *arg)
+{
+    ring_t *r = arg;
+
+    my_ring = NULL;
+    __atomic_store_n(&r->owned, 0, __ATOMIC_RELEASE);
+}
+
+/*********************************
+ * The flusher
+ *********************************/
+
+/*
+ * flush_thread - drain the rings until the program exits
+ */
+static void *flush_thread(void *arg)
+{
+    struct timespec idle = {0, FLUSH_NSECS};
+
+    (void)arg;
+    in_hook = 1;    /* our own allocations are not recorded */
+    while (!stopping) {
+	if (drain(0) == 0)
+	    nanosleep(&idle, NULL);
+    }
+    return NULL;
+}
+
+/*
+ * drain - write the events of all rings in sequence order. Each ring
+ *     is in order already, so this merges them, and stops at a gap in
+ *     the sequence (a thread took a number but has not published its
+ *     event yet) unless all is set. Returns the number of events.
+ */
+static unsigned long drain(int all)
+{
+    ring_t *r, *min;
+    event_t e;
+    unsigned long n = 0;
+
+    for (;;) {
+	/* the ring holding the next event */
+	min = NULL;
+	for (r = rings; r != NULL; r = r->next)
+	    if (r->tail != __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) &&
+		(min == NULL ||
+		 r->events[r->tail & r->mask].seq < min->events[min->tail & min->mask].seq))
+		min = r;
+	if (min == NULL)
+	    return n;
+
+	/* take all of its events that follow each other */
+	do {
+	    e = min->events[min->tail & min->mask];
+	    if (e.seq != order_seq && !all)
+		return n;
+	    __atomic_store_n(&min->tail, min->tail + 1, __ATOMIC_RELEASE);
+	    order_seq = e.seq + 1;
+	    handle(&e);
+	    n++;
+	} while (min->tail != __atomic_load_n(&min->head, __ATOMIC_ACQUIRE) &&
+		 min->events[min->tail & min->mask].seq == order_seq);
+    }
+}
+
+/*
+ * handle - turn one event into trace records
+ */
+static void handle(event_t *e)
+{
+    unsigned int *idp;
+    unsigned int id;
+
+    if (e->type == REALLOC && e->old == NULL)
+	e->type = ALLOC;        /* realloc(NULL, size) */
+
+    switch (e->type) {
+    case ALLOC:
+    case ALLOC_ALIGNED:
+	if ((idp = map_find(e->ptr)) != NULL) {
+	    /* handed out twice, we missed the free of the first block */
+	    emit(FREE, *idp, 0, 1);
+	    map_del(e->ptr);
+	    fixups++;
+	}
+	id = num_ids++;
+	map_put(e->ptr, id);
+	if (e->type == ALLOC_ALIGNED)
+	    emit(ALLOC_ALIGNED, id, e->size, (unsigned int)(size_t)e->old);
+	else
+	    emit(ALLOC, id, e->size, 1);
+	break;
+
+    case FREE:
+	if ((idp = map_find(e->ptr)) == NULL) {
+	    unknown++;          /* allocated before the capture started */
+	    break;
+	}
+	emit(FREE, *idp, 0, 1);
+	map_del(e->ptr);
+	break;
+
+    case REALLOC:
+	if (e->size == 0 && e->ptr == e->old)
+	    break;              /* realloc failed, nothing changed */
+	if ((idp = map_find(e->old)) == NULL) {
+	    unknown++;
+	    if (e->ptr != NULL) {
+		e->type = ALLOC;
+		handle(e);
+	    }
+	    break;
+	}
+	id = *idp;
+	map_del(e->old);
+	if (e->ptr == NULL) {   /* realloc(ptr, 0) freed the block */
+	    emit(FREE, id, 0, 1);
+	    break;
+	}
+	if ((idp = map_find(e->ptr)) != NULL) {
+	    emit(FREE, *idp, 0, 1);
+	    map_del(e->ptr);
+	    fixups++;
+	}
+	map_put(e->ptr, id);
+	emit(REALLOC, id, e->size, 1);
+	break;
+    }
+}
+
+/*
+ * emit - append a record to the trace, sizes are clamped to what a
+ *     trace can hold and mdriver accepts. count is the alignment of an
+ *     aligned alloc, which goes in the ARG record after it, else 1.
+ */
+static void emit(int type, unsigned int id, size_t size, unsigned int count)
+{
+    if (id > TRACE_MAX_ID) {
+	if (id == TRACE_MAX_ID + 1)
+	    fprintf(stderr, "capture: out of trace ids, stopped recording\n");
+	return;
+    }
+    if (type != FREE && size == 0)
+	size = 1;
+    if (size > 0xffffffffUL)
+	size = 0xffffffffUL;
+    out[num_out].type = type;
+    out[num_out].index = id;
+    out[num_out].size = (unsigned int)size;
+    if (++num_out == OUT_BATCH)
+	flush_out();
+    if (type == ALLOC_ALIGNED) {
+	out[num_out].type = ARG;
+	out[num_out].index = 0;
+	out[num_out].size = count;
+	if (++num_out == OUT_BATCH)
+	    flush_out();
+    }
+}
+
+static void flush_out(void)
+{
+    fwrite(out, sizeof(traceop_t), num_out, tracefile);
+    num_ops += num_out;
+    num_out = 0;
+}
+
+/*
+ * stop_capture - at exit, write what is left and the header
+ */
+static void stop_capture(void)
+{
+    trace_hdr_t hdr;
+
+    if (!capturing)
+	return;
+    in_hook = 1;
+    stopping = 1;
+    pthread_join(flusher, NULL);
+    capturing = 0;
+
+    drain(1);
+    flush_out();
+
+    hdr.magic = TRACE_MAGIC;
+    hdr.version = TRACE_VERSION;
+    hdr.sugg_heapsize = 0;
+    hdr.num_ids = num_ids > TRACE_MAX_ID + 1 ? TRACE_MAX_ID + 1 : num_ids;
+    hdr.num_ops = num_ops;
+    hdr.weight = 1;
+    fseek(tracefile, 0, SEEK_SET);
+    fwrite(&hdr, sizeof(hdr), 1, tracefile);
+    if (fclose(tracefile) != 0)
+	fprintf(stderr, "capture: could not write %s\n", path);
+    if (getenv("MM_CAPTURE_VERBOSE") != NULL || fixups > 0)
+	fprintf(stderr, "capture: %s: %lu records, %u ids, %lu fixups, "
+		"%lu frees of unknown blocks\n", path, num_ops, num_ids,
+		fixups, unknown);
+}
+
+/*
+ * child_after_fork - a forked child has no flusher, it does not record
+ */
+static void child_after_fork(void)
+{
+    capturing = 0;
+    stopping = 1;
+}
+
+/*********************************
+ * Flusher data structures
+ *********************************/
+
+/* hash of a block address, blocks are at least 16 byte aligned */
+#define MAP_HASH(p) ((((unsigned long)(p) >> 4) * 0x9e3779b97f4a7c15UL) >> 17)
+
+/*
+ * map_find - return the id of a live block, NULL if it has none
+ */
+static unsigned int *map_find(void *ptr)
+{
+    unsigned long i;
+
+    if (map_size == 0)
+	return NULL;
+    for (i = MAP_HASH(ptr) & (map_size - 1); map[i].ptr != NULL;
+	 i = (i + 1) & (map_size - 1))
+	if (map[i].ptr == ptr)
+	    return &map[i].id;
+    return NULL;
+}
+
+/*
+ * map_put - add a live block, the map is kept at most half full
+ */
+static void map_put(void *ptr, unsigned int id)
+{
+    unsigned long i;
+
+    if (2 * (map_used + 1) > map_size) {
+	slot_t *old = map;
+	unsigned long old_size = map_size;
+
+	map_size = map_size ? 2 * map_size : MAP_MIN;
+	if ((map = real_calloc(map_size, sizeof(slot_t))) == NULL) {
+	    fprintf(stderr, "capture: out of memory\n");
+	    abort();
+	}
+	map_used = 0;
+	for (i = 0; i < old_size; i++)
+	    if (old[i].ptr != NULL)
+		map_put(old[i].ptr, old[i].id);
+	real_free(old);
+    }
+
+    for (i = MAP_HASH(ptr) & (map_size - 1); map[i].ptr != NULL;
+	 i = (i + 1) & (map_size - 1))
+	;
+    map[i].ptr = ptr;
+    map[i].id = id;
+    map_used++;
+}
+
+/*
+ * map_del - remove a block, the entries after it move back so that no
+ *     probe sequence has a hole
+ */
+static void map_del(void *ptr)
+{
+    unsigned long i, j, home;
+
+    for (i = MAP_HASH(ptr) & (map_size - 1); map[i].ptr != ptr;
+	 i = (i + 1) & (map_size - 1))
+	;
+    map[i].ptr = NULL;
+    map_used--;
+
+    for (j = (i + 1) & (map_size - 1); map[j].ptr != NULL;
+	 j = (j + 1) & (map_size - 1)) {
+	home = MAP_HASH(map[j].ptr) & (map_size - 1);
+	/* move j back to i unless its home lies in (i, j] */
+	if ((j > i && (home <= i || home > j)) ||
+	    (j < i && (home <= i && home > j))) {
+	    map[i] = map[j];
+	    map[j].ptr = NULL;
+	    i = j;
+	}
+    }
+}
@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/times.h>
+#include <time.h>
 #include "clock.h"
 
 
@@ -163,6 +164,32 @@ double get_counter()
 
 
 
+/* 
+ * read_counter - return the raw cycle counter. Cheaper than 
+ * start_counter()/get_counter() and available on more platforms, 
+ * falls back to a nanosecond clock where we have no counter.
+ */
+unsigned long long read_counter(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned hi, lo;
+
+    asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((unsigned long long)hi << 32) | lo;
+#elif defined(__aarch64__)
+    unsigned long long v;
+
+    asm volatile("mrs %0, cntvct_el0" : "=r" (v));
+    return v;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+
 /*******************************
  * Machine-independent functions
  ******************************/
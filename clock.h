@@ -20,3 +20,6 @@ double mhz_full(int verbose, int sleeptime);
 void start_comp_counter();
 
 double get_comp_counter();
+
+/* Return the raw cycle counter, cheap enough to read around every request */
+unsigned long long read_counter(void);
@@ -53,15 +53,21 @@
 #define UTIL_WEIGHT .60
 
 /* 
- * Alignment requirement in bytes (either 4 or 8) 
+ * Alignment requirement in bytes (16 on x86-64 and aarch64) 
  */
-#define ALIGNMENT 8  
+#define ALIGNMENT 16
 
 /* 
  * Maximum heap size in bytes 
  */
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
 
+/*
+ * Maximum number of simulated heaps (arenas) in memlib.c, each one
+ * at most MAX_HEAP bytes
+ */
+#define MAX_ARENAS 16
+
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
@@ -0,0 +1,82 @@
+/*
+ * hist.c - log-bucket latency histograms (HDR style)
+ *
+ * A value v is stored with HIST_SUB_BITS bits of precision: its
+ * bucket is given by the position of its most significant bit and
+ * the HIST_SUB_BITS bits that follow it.
+ */
+#include <string.h>
+#include "hist.h"
+
+/* compute the bucket of value v */
+static int bucket(unsigned long long v)
+{
+    int msb;
+
+    if (v < HIST_SUB)
+	return (int)v;
+    msb = 63 - __builtin_clzll(v);
+    return (msb - HIST_SUB_BITS + 1) * HIST_SUB +
+	(int)((v >> (msb - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/* compute the biggest value that falls in bucket b */
+static unsigned long long bucket_top(int b)
+{
+    int msb;
+
+    if (b < HIST_SUB)
+	return b;
+    msb = b / HIST_SUB + HIST_SUB_BITS - 1;
+    return ((unsigned long long)(HIST_SUB + b % HIST_SUB + 1) << (msb - HIST_SUB_BITS)) - 1;
+}
+
+/*
+ * hist_reset - empty a histogram
+ */
+void hist_reset(hist_t *h)
+{
+    memset(h, 0, sizeof(hist_t));
+}
+
+/*
+ * hist_add - record one value
+ */
+void hist_add(hist_t *h, unsigned long long v)
+{
+    h->count[bucket(v)]++;
+    h->total++;
+    if (v > h->max)
+	h->max = v;
+}
+
+/*
+ * hist_percentile - return the p-th quantile of the values, by nearest
+ *    rank, the ceil(p * total)-th smallest value. It is rounded up to
+ *    the top of its bucket but never above the biggest value.
+ */
+unsigned long long hist_percentile(hist_t *h, double p)
+{
+    unsigned long long rank, seen = 0;
+    unsigned long long top;
+    double exact;
+    int b;
+
+    if (h->total == 0)
+	return 0;
+
+    /* the slack keeps a product like 0.07 * 100 from rounding up past 7 */
+    exact = p * h->total - 1e-9;
+    rank = (unsigned long long)exact;
+    if (rank < exact)
+	rank++;
+    if (rank < 1)
+	rank = 1;
+    for (b = 0; b < HIST_BUCKETS; b++) {
+	seen += h->count[b];
+	if (seen >= rank)
+	    break;
+    }
+    top = bucket_top(b);
+    return (top < h->max) ? top : h->max;
+}
@@ -0,0 +1,27 @@
+/*
+ * hist.h - log-bucket latency histograms (HDR style)
+ */
+
+/*
+ * Values below HIST_SUB get a bucket each. Above that every power of
+ * two is split into HIST_SUB buckets, so a bucket is at most 1/HIST_SUB
+ * of its value wide.
+ */
+#define HIST_SUB_BITS 4
+#define HIST_SUB      (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS  ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct {
+    unsigned long long count[HIST_BUCKETS]; /* number of values per bucket */
+    unsigned long long total;               /* number of values */
+    unsigned long long max;                 /* biggest value */
+} hist_t;
+
+/* Empty a histogram */
+void hist_reset(hist_t *h);
+
+/* Record one value */
+void hist_add(hist_t *h, unsigned long long v);
+
+/* Return the upper bound of the bucket that holds the p-th quantile, 0 <= p <= 1 */
+unsigned long long hist_percentile(hist_t *h, double p);
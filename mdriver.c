@@ -7,6 +7,7 @@
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE     /* for the CPU affinity of the -j threads */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -15,10 +16,27 @@
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <math.h>
+#include <dlfcn.h>
+#include <sched.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#if MM_THREADSAFE
+#include <pthread.h>
+#include <sys/syscall.h>
+#endif
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "clock.h"
+#include "hist.h"
+#include "perfctr.h"
+#include "trace.h"
+#include "backend.h"
 #include "config.h"
 
 /**********************
@@ -29,39 +47,39 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define RANGE_CHUNK 1024 /* range structs the pool gets from malloc at once */
+#define RESIDENT_SAMPLES 64 /* times the resident heap is measured per trace */
+#define MAX_BACKENDS   16 /* most allocators -b can run side by side */
+#define MAX_SYSALLOCS   8 /* most outside packages -l and -D can add */
+#define MAX_RUNS       20 /* most timed runs of a package -r can ask for */
+#define MAX_SAMPLES   100 /* most runs of mdriver a results file can pool for one result */
+#define REGRESSION     10 /* default percent a result may fall behind its baseline (-x) */
+
+/* Multithreaded replay */
+#define MT_QUEUE_SIZE   64 /* blocks in flight between two threads */
+#define MT_RUNS          3 /* each replay is timed this many times, fastest wins */
+#define NODE_CPUS "/sys/devices/system/node/node%d/cpulist" /* the CPUs of a NUMA node */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
+#define IS_ALIGNED(p)  ((((size_t)(p)) % ALIGNMENT) == 0)
 
 /****************************** 
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* 
+ * Records the extent of each block's payload. The ranges of a trace
+ * form a treap ordered by lo (and heap ordered by prio), so finding,
+ * adding and removing a range takes O(log n) expected time.
+ */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    unsigned int prio;     /* random treap priority, parents have higher ones */
+    struct range_t *left;  /* ranges with a smaller lo */
+    struct range_t *right; /* ranges with a bigger lo (next free one in the pool) */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
-
-/* Holds the information for one trace file*/
-typedef struct {
-    int sugg_heapsize;   /* suggested heap size (unused) */
-    int num_ids;         /* number of alloc/realloc ids */
-    int num_ops;         /* number of distinct requests */
-    int weight;          /* weight for this trace (unused) */
-    traceop_t *ops;      /* array of requests */
-    char **blocks;       /* array of ptrs returned by malloc/realloc... */
-    size_t *block_sizes; /* ... and a corresponding array of payload sizes */
-} trace_t;
-
 /* 
  * Holds the params to the xxx_speed functions, which are timed by fcyc. 
  * This struct is necessary because fcyc accepts only a pointer array
@@ -70,31 +88,162 @@ typedef struct {
 typedef struct {
     trace_t *trace;  
     range_t *ranges;
+    hist_t *hists;   /* if not NULL, per request type latencies (in cycles) */
+    int touch;       /* if set, touch the payloads as -T and -R say */
 } speed_t;
 
+#if MM_THREADSAFE
+/* Blocks one thread hands to the next one to free (single producer and consumer) */
+typedef struct {
+    char *slots[MT_QUEUE_SIZE];
+    unsigned long head;     /* next slot the consumer reads */
+    unsigned long tail;     /* next slot the producer writes */
+} mt_queue_t;
+
+/* Holds the params and results of one thread of a multithreaded replay */
+typedef struct {
+    trace_t *trace;         /* the trace, whose blocks array all threads share */
+    traceop_t *ops;         /* the requests of this thread's shard of the ids */
+    int num_ops;            /* number of records in the shard */
+    int num_reqs;           /* number of requests in the shard */
+    int xfree;              /* if set, frees are handed to the next thread */
+    mt_queue_t *in;         /* blocks other threads want us to free */
+    mt_queue_t *out;        /* where our frees go if xfree is set */
+    cpu_set_t *cpus;        /* CPUs the thread is pinned to, NULL if not pinned */
+    int locality;           /* if set, fill in the counts below instead of timing */
+    long local_allocs;      /* blocks on a page of the thread's node */
+    long remote_allocs;     /* blocks on a page of another node */
+    long remote_frees;      /* blocks freed from another node than their page's */
+    double secs;            /* time this thread needed for its shard */
+} mt_thread_t;
+#endif
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
     double ops;      /* number of ops (malloc/free/realloc) in the trace */
     int valid;       /* was the trace processed correctly by the allocator? */
     double secs;     /* number of secs needed to run the trace */
+    int runs;        /* number of timed runs (-r), secs is their mean */
+    double run_secs[MAX_RUNS]; /* the secs of each of them */
+    double touch_secs; /* same, touching the payloads (only with -T or -R) */
+    double huge_secs;  /* same, on a huge page heap (only with -L) */
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    hist_t *latency; /* per request type latencies, only with -H (else NULL) */
+    double *events;  /* hardware events per op, only with -e (else NULL) */
+    double heap_peak;     /* largest heap plus mapped size (bytes) */
+    double resident_max;  /* most heap bytes in memory at one sample */
+    double resident_avg;  /* average of the samples of heap bytes in memory */
+    double resident_end;  /* heap bytes in memory after the last request */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
+/* 
+ * A malloc package outside the simulated heap, which is evaluated the
+ * way libc malloc is: for correctness and speed, but not utilization.
+ * -l adds libc malloc, -D loads others from shared libraries.
+ */
+typedef struct {
+    char *name;
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+    int (*posix_memalign)(void **ptr, size_t align, size_t size);
+} sysalloc_t;
+
+/* The traces and malloc packages main evaluates, and their stats */
+typedef struct {
+    char **tracefiles;    /* null-terminated array of trace file names */
+    int num_tracefiles;   /* the number of traces in that array */
+    sysalloc_t **sysallocs; /* the outside packages to evaluate */
+    int num_sysallocs;    /* the number of packages in that array */
+    stats_t **sys_stats;  /* stats of each outside package for each trace */
+    backend_t **backends; /* the malloc packages to evaluate */
+    int num_backends;     /* the number of packages in that array */
+    stats_t **mm_stats;   /* stats of each package for each trace */
+    int *mm_errors;       /* number of errors of each package */
+    int latency;          /* if set, measure per-request latencies (-H) */
+    int jobs;             /* if set, replay on up to this many threads (-j) */
+} suite_t;
+
+/* 
+ * The stats a -w worker sends back for one package on one trace. The
+ * latency and events pointers only tell if their data follows it.
+ */
+typedef struct {
+    int tracenum;    /* the trace */
+    int pkg;         /* index of the package, -1 - index for an outside one */
+    int errors;      /* errors the package made on the trace */
+    stats_t stats;   /* its stats */
+} result_t;
+
+/* 
+ * The results of a package on one trace, or on all of them, as the
+ * results files of -o and -C hold them
+ */
+typedef struct {
+    int valid;       /* were the traces processed correctly? */
+    double ops;      /* number of requests */
+    double util;     /* space utilization, -1 for an outside package */
+    double kops;     /* mean throughput of the timed runs (Kops/sec) */
+    double sd;       /* standard deviation of the throughput of a run, 0 for 1 run */
+    double ci;       /* half width of the 95% confidence interval of the mean */
+    int runs;        /* number of timed runs, or of runs of mdriver it pools */
+    double run_kops[MAX_SAMPLES]; /* the throughput of each of them */
+} bench_t;
+
+/* One package on one trace (or "total") in a results file */
+typedef struct {
+    char name[MAXLINE];  /* the package */
+    char trace[MAXLINE]; /* the trace */
+    bench_t result;      /* its results, pooled over the lines of the file */
+    int procs;           /* number of lines, each from a run of mdriver */
+    double proc_kops[MAX_SAMPLES]; /* the mean throughput of each */
+} bench_line_t;
+
+/* A -w worker process, as the driver sees it */
+typedef struct {
+    pid_t pid;       /* its process id */
+    int cmd;         /* pipe the numbers of its traces go to, -1 when closed */
+    int tracenum;    /* trace it evaluates, -1 if none */
+} worker_t;
+
 /********************
  * Global variables
  *******************/
 int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
+static backend_t *backend; /* the malloc package being evaluated */
+static sysalloc_t *sysalloc; /* the outside package being evaluated */
+static int num_runs = 1;    /* timed runs of each package on each trace (-r) */
+static int check_heap = 0; /* if set, check the heap after every request (-c) */
+static int count_events = 0; /* if set, count hardware events per op (-e) */
+static int touch_percent = 0; /* percent of each payload written (-T) */
+static int touch_read = 0;  /* if set, read payloads back before free (-R) */
+static int size_hints = 0;  /* if set, pass block sizes to free and realloc (-z) */
+static int huge_pages = 0;  /* MEM_xxx flags of the heap of an extra timing pass (-L, -P) */
+static int sample_ops = 0;  /* if set, sample the heap layout every so many requests (-s) */
+static FILE *sample_fp;     /* where the samples go (-S), stdout by default */
+static int sample_json = 0; /* if set, the samples are a JSON array, else CSV */
+static int num_samples = 0; /* samples written so far */
+static cpu_set_t pin_cpus;  /* CPUs the timed runs are pinned to (-k), empty if none */
+static volatile unsigned long touch_sum; /* keeps the reads of -R alive */
+#if MM_THREADSAFE
+static int pin_threads = 0; /* if set, spread the -j threads over the NUMA nodes (-p) */
+static cpu_set_t *node_cpus; /* the CPUs of each node, for -p */
+static int num_nodes;       /* number of entries of node_cpus */
+#endif
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
+/* libc malloc, for -l */
+static sysalloc_t libc_alloc = {"libc", malloc, free, realloc, posix_memalign};
+
 /* The filenames of the default tracefiles */
 static char *default_tracefiles[] = {  
     DEFAULT_TRACEFILES, NULL
@@ -106,27 +255,98 @@ static char *default_tracefiles[] = {
  *********************/
 
 /* these functions manipulate range lists */
-static int add_range(range_t **ranges, char *lo, int size, 
+static int add_range(range_t **ranges, char *lo, int size, int align,
 		     int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
+static range_t *find_range(range_t *ranges, char *addr);
+static range_t *insert_range(range_t *ranges, range_t *p);
+static range_t *alloc_range(void);
+static void free_range(range_t *p);
 
 /* These functions read, allocate, and free storage for traces */
-static trace_t *read_trace(char *tracedir, char *filename);
-static void free_trace(trace_t *trace);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace, int tracenum);
 static void eval_libc_speed(void *ptr);
+static sysalloc_t *load_sysalloc(char *spec);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			   stats_t *stats);
 static void eval_mm_speed(void *ptr);
+static void touch_payload(trace_t *trace, int index, int oldsize, int size);
+static void read_payload(trace_t *trace, int index);
+static int batch_malloc(size_t size, char **blocks, int n);
+static void batch_free(char **blocks, int n);
+static char *aligned_malloc(size_t align, size_t size);
+static void sized_free(trace_t *trace, int index);
+static char *sized_realloc(trace_t *trace, int index, int size);
+static void eval_mm(trace_t *trace, int tracenum, stats_t *stats,
+		    range_t **ranges, int latency, int jobs);
+static void eval_trace(suite_t *suite, int tracenum, range_t **ranges);
+static double time_runs(fsecs_test_funct f, speed_t *speed_params, stats_t *stats);
+
+/* Evaluation of the traces in worker processes (-w) */
+static void eval_parallel(suite_t *suite, int workers);
+static void hand_out(suite_t *suite, worker_t *worker, struct pollfd *pfd,
+		     int *next);
+static void worker_died(suite_t *suite, worker_t *workers, int num_workers,
+			int w);
+static void worker_run(suite_t *suite, int w, int in, int out);
+static void send_result(int fd, int tracenum, int pkg, int errs,
+			stats_t *stats);
+static int recv_result(int fd, suite_t *suite);
+static int read_full(int fd, void *buf, size_t n);
+static void write_full(int fd, void *buf, size_t n);
+
+#if MM_THREADSAFE
+/* Routines for replaying a trace on several threads at once */
+static void eval_mm_mt(trace_t *trace, int tracenum, int jobs, int xfree);
+static double mt_replay(trace_t *trace, int nthreads, int xfree, mt_thread_t *threads);
+static void *mt_thread(void *ptr);
+static void mt_drain(mt_thread_t *thread);
+static void mt_locality(trace_t *trace, int nthreads, int xfree, mt_thread_t *threads);
+static void mt_count_alloc(mt_thread_t *thread, char *p);
+static void mt_free(mt_thread_t *thread, char *p);
+static int node_cpus_init(void);
+static int page_node(void *p);
+static int cpu_node(void);
+#endif
+
+/* Heap layout samples */
+static void samples_open(char *file);
+static void sample_heap(int tracenum, int opnum, int live, double cycles);
+static void samples_close(void);
 
 /* Various helper routines */
+static int parse_backends(char *names, backend_t **backends);
+static int parse_cpulist(char *list, cpu_set_t *set);
+static void pin_cpu(int n);
+static double *count_perf(perf_test_funct f, speed_t *speed_params,
+			  int num_ops);
 static void printresults(int n, stats_t *stats);
+static void printevent(double count);
+static void printcompare(int n, int nb, backend_t **backends, stats_t **stats);
+static double printperfindex(int n, stats_t *stats, int errs, int *numcorrect);
+static void printlatencies(int n, stats_t *stats);
+static void printresident(int n, stats_t *stats);
+static void printbench(suite_t *suite);
+
+/* Results files, to check for regressions against a baseline */
+static void bench_result(stats_t *stats, int n, int tracenum, int outside,
+			 bench_t *result);
+static void bench_stats(bench_t *result);
+static double t95(int df);
+static int slower(bench_t *base, bench_t *result);
+static int suite_results(suite_t *suite, bench_line_t **lines);
+static int read_results(char *file, bench_line_t **lines);
+static void write_results(char *file, bench_line_t *lines, int num_lines);
+static int compare_results(char *file, bench_line_t *lines, int num_lines,
+			   double threshold);
+static char *package(suite_t *suite, int p, stats_t **stats);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -141,24 +361,40 @@ int main(int argc, char **argv)
     char c;
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
-    trace_t *trace = NULL;     /* stores a single trace file in memory */
     range_t *ranges = NULL;    /* keeps track of block extents for one trace */
-    stats_t *libc_stats = NULL;/* libc stats for each trace */
-    stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
-    speed_t speed_params;      /* input parameters to the xx_speed routines */ 
+    sysalloc_t *sysallocs[MAX_SYSALLOCS]; /* the outside packages to evaluate */
+    int num_sysallocs = 0;           /* the number of packages in that array */
+    stats_t *sys_stats[MAX_SYSALLOCS]; /* stats of each of them for each trace */
+    stats_t *mm_stats[MAX_BACKENDS]; /* stats of each backend for each trace */
+    int mm_errors[MAX_BACKENDS];     /* number of errors of each backend */
+    backend_t *backends[MAX_BACKENDS]; /* the malloc packages to evaluate */
+    int num_backends = 0;            /* the number of packages in that array */
+    suite_t suite;             /* all of the above, for eval_trace */
 
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int jobs = 0;        /* If set, replay on up to this many threads (-j) */
+    int latency = 0;     /* If set, print per-request latency percentiles (-H) */
+    int workers = 0;     /* If set, evaluate the traces in this many processes (-w) */
+    char *results_file = NULL;  /* If set, write the results to this file (-o) */
+    char *baseline_file = NULL; /* If set, compare the results with this file (-C) */
+    char *input_file = NULL;    /* If set, compare the results in this file instead (-I) */
+    bench_line_t *lines = NULL; /* the results of each package on each trace */
+    int num_lines = 0;          /* the number of them */
+    double threshold = REGRESSION; /* percent a result may lose against it (-x) */
+    int regressions = 0;
 
     /* temporaries used to compute the performance index */
-    double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
-    int numcorrect;
+    double perfidx = 0;
+    int numcorrect = 0;
+    int b;
+    char *sample_file = NULL;
     
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "b:f:t:j:k:o:r:s:C:D:I:S:T:w:x:hvVgacelLpPRHz")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -181,9 +417,114 @@ int main(int argc, char **argv)
         case 'a': /* Don't check team structure */
             team_check = 0;
             break;
+        case 'b': /* Evaluate these malloc packages side by side */
+            num_backends = parse_backends(optarg, backends);
+            break;
+        case 'c': /* Check the heap after every request */
+            check_heap = 1;
+            break;
+        case 'e': /* Count hardware events per request */
+            count_events = 1;
+            break;
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'D': /* Run the malloc package of a shared library */
+            if (num_sysallocs == MAX_SYSALLOCS - 1) {
+		printf("ERROR: at most %d libraries can be given with -D\n",
+		       MAX_SYSALLOCS - 1);
+		exit(1);
+	    }
+            if ((sysallocs[num_sysallocs] = load_sysalloc(optarg)) != NULL)
+		num_sysallocs++;
+            break;
+        case 'r': /* Time each package this many times */
+            num_runs = atoi(optarg);
+            if (num_runs < 1 || num_runs > MAX_RUNS) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'o': /* Write the results to this file */
+            results_file = optarg;
+            break;
+        case 'C': /* Compare the results with this baseline */
+            baseline_file = optarg;
+            break;
+        case 'I': /* Compare the results in this file, run nothing */
+            input_file = optarg;
+            break;
+        case 'x': /* Flag results that fall this many percent behind */
+            threshold = atof(optarg);
+            if (threshold < 0) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'j': /* Replay each trace on 1..jobs threads */
+            jobs = atoi(optarg);
+            if (jobs < 1) {
+		usage();
+		exit(1);
+	    }
+#if !MM_THREADSAFE
+	    printf("ERROR: -j needs the thread safe driver, run make mdriver-mt\n");
+	    exit(1);
+#endif
+            break;
+        case 'k': /* Pin the timed runs to these CPUs */
+            if (parse_cpulist(optarg, &pin_cpus) == 0) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'w': /* Evaluate the traces in this many processes */
+            workers = atoi(optarg);
+            if (workers < 1) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'p': /* Pin the -j threads to the NUMA nodes */
+#if MM_THREADSAFE
+            pin_threads = 1;
+#else
+	    printf("ERROR: -p needs the thread safe driver, run make mdriver-mt\n");
+	    exit(1);
+#endif
+            break;
+        case 'T': /* Write this percent of each payload */
+            touch_percent = atoi(optarg);
+            if (touch_percent < 0 || touch_percent > 100) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'R': /* Read the payloads back before they are freed */
+            touch_read = 1;
+            break;
+        case 's': /* Sample the heap layout every so many requests */
+            sample_ops = atoi(optarg);
+            if (sample_ops < 1) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'S': /* Write the samples to this file */
+            sample_file = optarg;
+            break;
+        case 'z': /* Tell free and realloc the block sizes */
+            size_hints = 1;
+            break;
+        case 'L': /* Also time the replay on a huge page heap */
+            huge_pages |= MEM_HUGE_PAGES;
+            break;
+        case 'P': /* Same, with the heap faulted in up front */
+            huge_pages |= MEM_HUGE_PAGES | MEM_POPULATE;
+            break;
+        case 'H': /* Print per-request latency percentiles */
+            latency = 1;
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -198,6 +539,25 @@ int main(int argc, char **argv)
             exit(1);
         }
     }
+    if (workers && (jobs || sample_ops)) {
+	printf("ERROR: -w can't be combined with -j or -s\n");
+	exit(1);
+    }
+
+    /* 
+     * With -I the results come from a file, like the -o files of
+     * earlier runs put together, so there is nothing to evaluate
+     */
+    if (input_file != NULL) {
+	if (baseline_file == NULL) {
+	    printf("ERROR: -I needs a baseline to compare with, given with -C\n");
+	    exit(1);
+	}
+	num_lines = read_results(input_file, &lines);
+	regressions = compare_results(baseline_file, lines, num_lines,
+				      threshold / 100);
+	exit(regressions ? 2 : 0);
+    }
 	
     /* 
      * Check and print team info 
@@ -243,196 +603,308 @@ int main(int argc, char **argv)
 	printf("Using default tracefiles in %s\n", tracedir);
     }
 
+    /* By default only the mm package of mm.c is evaluated */
+    if (num_backends == 0) {
+	if ((backends[0] = backend_find("mm")) == NULL)
+	    backends[0] = backend_list();
+	num_backends = 1;
+    }
+
+    /* -R alone reads back whole payloads, so they are written as well */
+    if (touch_read && touch_percent == 0)
+	touch_percent = 100;
+
     /* Initialize the timing package */
     init_fsecs();
+    if (count_events && init_perf() == 0)
+	printf("Warning: no hardware events can be counted on this machine\n");
 
-    /*
-     * Optionally run and evaluate the libc malloc package 
-     */
+    /* libc malloc comes first of the outside packages */
     if (run_libc) {
-	if (verbose > 1)
-	    printf("\nTesting libc malloc\n");
-	
-	/* Allocate libc stats array, with one stats_t struct per tracefile */
-	libc_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
-	if (libc_stats == NULL)
-	    unix_error("libc_stats calloc in main failed");
-	
-	/* Evaluate the libc malloc package using the K-best scheme */
-	for (i=0; i < num_tracefiles; i++) {
-	    trace = read_trace(tracedir, tracefiles[i]);
-	    libc_stats[i].ops = trace->num_ops;
-	    if (verbose > 1)
-		printf("Checking libc malloc for correctness, ");
-	    libc_stats[i].valid = eval_libc_valid(trace, i);
-	    if (libc_stats[i].valid) {
-		speed_params.trace = trace;
-		if (verbose > 1)
-		    printf("and performance.\n");
-		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
-	    }
-	    free_trace(trace);
-	}
-
-	/* Display the libc results in a compact table */
-	if (verbose) {
-	    printf("\nResults for libc malloc:\n");
-	    printresults(num_tracefiles, libc_stats);
-	}
+	memmove(&sysallocs[1], &sysallocs[0], num_sysallocs * sizeof(sysalloc_t *));
+	sysallocs[0] = &libc_alloc;
+	num_sysallocs++;
     }
 
-    /*
-     * Always run and evaluate the student's mm package
-     */
-    if (verbose > 1)
-	printf("\nTesting mm malloc\n");
+    /* Allocate the stats arrays, with one stats_t struct per tracefile */
+    for (b = 0; b < num_sysallocs; b++) {
+	sys_stats[b] = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+	if (sys_stats[b] == NULL)
+	    unix_error("sys_stats calloc in main failed");
+    }
+    for (b = 0; b < num_backends; b++) {
+	mm_stats[b] = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+	if (mm_stats[b] == NULL)
+	    unix_error("mm_stats calloc in main failed");
+	mm_errors[b] = 0;
+    }
 
-    /* Allocate the mm stats array, with one stats_t struct per tracefile */
-    mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
-    if (mm_stats == NULL)
-	unix_error("mm_stats calloc in main failed");
-    
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
+    if (sample_ops)
+	samples_open(sample_file);
+#if MM_THREADSAFE
+    if (pin_threads)
+	node_cpus_init();
+#endif
 
-    /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
-	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
-	}
-	free_trace(trace);
+    /* 
+     * Evaluate the packages on each trace, one after the other or in
+     * -w worker processes
+     */
+    suite.tracefiles = tracefiles;
+    suite.num_tracefiles = num_tracefiles;
+    suite.sysallocs = sysallocs;
+    suite.num_sysallocs = num_sysallocs;
+    suite.sys_stats = sys_stats;
+    suite.backends = backends;
+    suite.num_backends = num_backends;
+    suite.mm_stats = mm_stats;
+    suite.mm_errors = mm_errors;
+    suite.latency = latency;
+    suite.jobs = jobs;
+    if (workers)
+	eval_parallel(&suite, workers);
+    else {
+	if (CPU_COUNT(&pin_cpus))
+	    pin_cpu(0);
+	for (i = 0; i < num_tracefiles; i++)
+	    eval_trace(&suite, i, &ranges);
     }
 
-    /* Display the mm results in a compact table */
-    if (verbose) {
-	printf("\nResults for mm malloc:\n");
-	printresults(num_tracefiles, mm_stats);
-	printf("\n");
+    /* Display the libc (and other outside) results in compact tables */
+    for (b = 0; b < num_sysallocs && verbose; b++) {
+	printf("\nResults for %s malloc:\n", sysallocs[b]->name);
+	printresults(num_tracefiles, sys_stats[b]);
     }
 
-    /* 
-     * Accumulate the aggregate statistics for the student's mm package 
-     */
-    secs = 0;
-    ops = 0;
-    util = 0;
-    numcorrect = 0;
-    for (i=0; i < num_tracefiles; i++) {
-	secs += mm_stats[i].secs;
-	ops += mm_stats[i].ops;
-	util += mm_stats[i].util;
-	if (mm_stats[i].valid)
-	    numcorrect++;
-    }
-    avg_mm_util = util/num_tracefiles;
+    /* Display the results of each mm package in compact tables */
+    for (b = 0; b < num_backends; b++) {
+	if (verbose) {
+	    printf("\nResults for %s malloc:\n", backends[b]->name);
+	    printresults(num_tracefiles, mm_stats[b]);
+	    printf("\n");
+	    printf("Resident heap for %s malloc (KB):\n", backends[b]->name);
+	    printresident(num_tracefiles, mm_stats[b]);
+	    printf("\n");
+	}
+	if (latency) {
+	    printf("\nLatencies for %s malloc (cycles):\n", backends[b]->name);
+	    printlatencies(num_tracefiles, mm_stats[b]);
+	    printf("\n");
+	}
+    }
+    if (num_backends > 1) {
+	printf("\nComparison of the mm packages:\n");
+	printcompare(num_tracefiles, num_backends, backends, mm_stats);
+	printf("\n");
+    }
+    if (num_runs > 1) {
+	printf("\nThroughput of %d runs (mean and 95%% confidence interval, Kops):\n",
+	       num_runs);
+	printbench(&suite);
+	printf("\n");
+    }
 
     /* 
-     * Compute and print the performance index 
+     * Compute and print the performance index of each package, the
+     * autograder summary is for the first one
      */
-    if (errors == 0) {
-	avg_mm_throughput = ops/secs;
-
-	p1 = UTIL_WEIGHT * avg_mm_util;
-	if (avg_mm_throughput > AVG_LIBC_THRUPUT) {
-	    p2 = (double)(1.0 - UTIL_WEIGHT);
-	} 
-	else {
-	    p2 = ((double) (1.0 - UTIL_WEIGHT)) * 
-		(avg_mm_throughput/AVG_LIBC_THRUPUT);
+    for (b = 0; b < num_backends; b++) {
+	int correct;
+	double idx;
+
+	if (num_backends > 1)
+	    printf("%s: ", backends[b]->name);
+	idx = printperfindex(num_tracefiles, mm_stats[b], mm_errors[b],
+			     &correct);
+	if (b == 0) {
+	    perfidx = idx;
+	    numcorrect = correct;
 	}
-	
-	perfindex = (p1 + p2)*100.0;
-	printf("Perf index = %.0f (util) + %.0f (thru) = %.0f/100\n",
-	       p1*100, 
-	       p2*100, 
-	       perfindex);
-	
-    }
-    else { /* There were errors */
-	perfindex = 0.0;
-	printf("Terminated with %d errors\n", errors);
     }
 
     if (autograder) {
 	printf("correct:%d\n", numcorrect);
-	printf("perfidx:%.0f\n", perfindex);
+	printf("perfidx:%.0f\n", perfidx);
     }
 
-    exit(0);
+    if (sample_ops)
+	samples_close();
+
+    /* Keep the results, and check them against the baseline */
+    if (results_file != NULL || baseline_file != NULL)
+	num_lines = suite_results(&suite, &lines);
+    if (results_file != NULL)
+	write_results(results_file, lines, num_lines);
+    if (baseline_file != NULL)
+	regressions = compare_results(baseline_file, lines, num_lines,
+				      threshold / 100);
+    exit(regressions ? 2 : 0);
 }
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the range tree, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks.
  ****************************************************************/
 
+/* Unused range structs, linked by their right pointers */
+static range_t *range_pool = NULL;
+
+/*
+ * alloc_range - Take a range struct from the pool, refilling the pool
+ *     with RANGE_CHUNK new ones when it is empty
+ */
+static range_t *alloc_range(void)
+{
+    static unsigned int seed = 1;
+    range_t *p;
+    int i;
+
+    if (range_pool == NULL) {
+	if ((p = (range_t *)malloc(RANGE_CHUNK * sizeof(range_t))) == NULL)
+	    unix_error("malloc error in alloc_range");
+	for (i = 0; i < RANGE_CHUNK; i++)
+	    free_range(&p[i]);
+    }
+    p = range_pool;
+    range_pool = p->right;
+
+    /* Priorities from a xorshift generator, so rand() stays untouched */
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    p->prio = seed;
+    p->left = p->right = NULL;
+    return p;
+}
+
+/*
+ * free_range - Give a range struct back to the pool
+ */
+static void free_range(range_t *p)
+{
+    p->right = range_pool;
+    range_pool = p;
+}
+
+/*
+ * find_range - Return the range with the biggest lo <= addr, or
+ *     NULL if there is none. Since the ranges never overlap, this is
+ *     the only one that can contain addr.
+ */
+static range_t *find_range(range_t *ranges, char *addr)
+{
+    range_t *best = NULL;
+
+    while (ranges != NULL) {
+	if (ranges->lo <= addr) {
+	    best = ranges;
+	    ranges = ranges->right;
+	}
+	else
+	    ranges = ranges->left;
+    }
+    return best;
+}
+
+/*
+ * insert_range - Add range p to the treap rooted at ranges and return
+ *     the new root, rotating p up past any parent with a lower priority
+ */
+static range_t *insert_range(range_t *ranges, range_t *p)
+{
+    range_t *q;
+
+    if (ranges == NULL)
+	return p;
+
+    if (p->lo < ranges->lo) {
+	ranges->left = insert_range(ranges->left, p);
+	if (ranges->left->prio > ranges->prio) {
+	    q = ranges->left;
+	    ranges->left = q->right;
+	    q->right = ranges;
+	    return q;
+	}
+    }
+    else {
+	ranges->right = insert_range(ranges->right, p);
+	if (ranges->right->prio > ranges->prio) {
+	    q = ranges->right;
+	    ranges->right = q->left;
+	    q->left = ranges;
+	    return q;
+	}
+    }
+    return ranges;
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
- *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     size bytes at addr lo, aligned to align bytes. After checking the
+ *     block for correctness, we create a range struct for this block and
+ *     add it to the range tree. 
  */
-static int add_range(range_t **ranges, char *lo, int size, 
+static int add_range(range_t **ranges, char *lo, int size, int align,
 		     int tracenum, int opnum)
 {
     char *hi = lo + size - 1;
     range_t *p;
+    mem_arena_t *arena;
     char msg[MAXLINE];
 
     assert(size > 0);
 
-    /* Payload addresses must be ALIGNMENT-byte aligned */
-    if (!IS_ALIGNED(lo)) {
+    /* Payload addresses must be ALIGNMENT-byte aligned, or more if asked */
+    if (!IS_ALIGNED(lo) || ((size_t)lo % align) != 0) {
 	sprintf(msg, "Payload address (%p) not aligned to %d bytes", 
-		lo, ALIGNMENT);
+		lo, align > ALIGNMENT ? align : ALIGNMENT);
         malloc_error(tracenum, opnum, msg);
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* 
+     * The payload must lie within the extent of the arena that holds it,
+     * or within a single mapped region
+     */
+    if ((arena = mem_arena_of(lo)) == NULL) {
+	if (!mem_mapped(lo, size)) {
+	    sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p) and any mapped region",
+		    lo, hi, mem_heap_lo(), mem_heap_hi());
+	    malloc_error(tracenum, opnum, msg);
+	    return 0;
+	}
+    }
+    else if (hi > (char *)mem_arena_hi(arena)) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
-		lo, hi, mem_heap_lo(), mem_heap_hi());
+		lo, hi, mem_arena_lo(arena), mem_arena_hi(arena));
 	malloc_error(tracenum, opnum, msg);
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
+    /* 
+     * The payload must not overlap any other payloads. It does if and
+     * only if the last range starting at or below hi reaches lo.
+     */
+    if ((p = find_range(*ranges, hi)) != NULL && p->hi >= lo) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, p->lo, p->hi);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
     }
 
     /* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and adding it the range tree.
      */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-	unix_error("malloc error in add_range");
-    p->next = *ranges;
+    p = alloc_range();
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    *ranges = insert_range(*ranges, p);
     return 1;
 }
 
@@ -441,19 +913,34 @@ static int add_range(range_t **ranges, char *lo, int size,
  */
 static void remove_range(range_t **ranges, char *lo)
 {
-    range_t *p;
+    range_t *p, *q;
     range_t **prevpp = ranges;
-    int size;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+    /* Find the link that points at the range */
+    for (p = *ranges;  p != NULL && p->lo != lo;  p = *prevpp)
+	prevpp = (lo < p->lo) ? &(p->left) : &(p->right);
+    if (p == NULL)
+	return;
+
+    /* Rotate it down, keeping the treap order, until it is a leaf */
+    while (p->left != NULL && p->right != NULL) {
+	if (p->left->prio > p->right->prio) {
+	    q = p->left;
+	    p->left = q->right;
+	    q->right = p;
+	    *prevpp = q;
+	    prevpp = &(q->right);
+	}
+	else {
+	    q = p->right;
+	    p->right = q->left;
+	    q->left = p;
+	    *prevpp = q;
+	    prevpp = &(q->left);
+	}
     }
+    *prevpp = (p->left != NULL) ? p->left : p->right;
+    free_range(p);
 }
 
 /*
@@ -461,131 +948,192 @@ static void remove_range(range_t **ranges, char *lo)
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
+    range_t *p = *ranges;
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
-    }
+    if (p == NULL)
+	return;
+    clear_ranges(&(p->left));
+    clear_ranges(&(p->right));
+    free_range(p);
     *ranges = NULL;
 }
 
 
-/**********************************************
- * The following routines manipulate tracefiles
- *********************************************/
+/**********************************************************************
+ * The following functions evaluate the correctness, space utilization,
+ * and throughput of the libc and mm malloc packages.
+ **********************************************************************/
+
+/*
+ * eval_mm - Evaluate the correctness, space utilization and speed of
+ * the current backend on a trace and fill in its stats
+ */
+static void eval_mm(trace_t *trace, int tracenum, stats_t *stats,
+		    range_t **ranges, int latency, int jobs)
+{
+    speed_t speed_params;
+
+    stats->ops = trace->num_reqs;
+    if (verbose > 1)
+	printf("Checking %s malloc for correctness, ", backend->name);
+    stats->valid = eval_mm_valid(trace, tracenum, ranges);
+    if (!stats->valid)
+	return;
+
+    if (verbose > 1)
+	printf("efficiency, ");
+    stats->util = eval_mm_util(trace, tracenum, ranges, stats);
+    speed_params.trace = trace;
+    speed_params.ranges = *ranges;
+    speed_params.hists = NULL;
+    speed_params.touch = 0;
+    if (verbose > 1)
+	printf("and performance.\n");
+    stats->secs = time_runs(eval_mm_speed, &speed_params, stats);
+    if (touch_percent) {
+	speed_params.touch = 1;
+	stats->touch_secs = fsecs(eval_mm_speed, &speed_params);
+	speed_params.touch = 0;
+    }
+
+    /* 
+     * The same replay on a fresh default arena on huge pages, touching
+     * the payloads if -T or -R asked for it, since that is where the
+     * TLB misses are
+     */
+    if (huge_pages) {
+	mem_deinit();
+	mem_init_flags(huge_pages);
+	speed_params.touch = (touch_percent != 0);
+	stats->huge_secs = fsecs(eval_mm_speed, &speed_params);
+	speed_params.touch = 0;
+	mem_deinit();
+	mem_init();
+    }
+
+    /* One more, separate, pass so the timestamps don't skew secs */
+    if (latency) {
+	int t;
+
+	stats->latency = (hist_t *)malloc(NUM_OPTYPES * sizeof(hist_t));
+	if (stats->latency == NULL)
+	    unix_error("latency malloc in eval_mm failed");
+	for (t = 0; t < NUM_OPTYPES; t++)
+	    hist_reset(&stats->latency[t]);
+	speed_params.hists = stats->latency;
+	eval_mm_speed(&speed_params);
+	speed_params.hists = NULL;
+    }
+    if (count_events)
+	stats->events = count_perf(eval_mm_speed, &speed_params,
+				   trace->num_reqs);
+#if MM_THREADSAFE
+    if (jobs) {
+	eval_mm_mt(trace, tracenum, jobs, 0);
+	eval_mm_mt(trace, tracenum, jobs, 1);
+    }
+#endif
+}
 
 /*
- * read_trace - read a trace file and store it in memory
+ * eval_trace - Read a trace once, then evaluate libc malloc and the
+ *     other outside packages (optionally) and every mm package of the
+ *     suite on it using the K-best scheme
  */
-static trace_t *read_trace(char *tracedir, char *filename)
+static void eval_trace(suite_t *suite, int tracenum, range_t **ranges)
 {
-    FILE *tracefile;
     trace_t *trace;
-    char type[MAXLINE];
-    char path[MAXLINE];
-    unsigned index, size;
-    unsigned max_index = 0;
-    unsigned op_index;
+    stats_t *stats;
+    speed_t speed_params;
+    int i = tracenum;
+    int b;
 
     if (verbose > 1)
-	printf("Reading tracefile: %s\n", filename);
+	printf("Reading tracefile: %s\n", suite->tracefiles[i]);
+    trace = read_trace(tracedir, suite->tracefiles[i]);
 
-    /* Allocate the trace record */
-    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
-	unix_error("malloc 1 failed in read_trance");
-	
-    /* Read the trace file header */
-    strcpy(path, tracedir);
-    strcat(path, filename);
-    if ((tracefile = fopen(path, "r")) == NULL) {
-	sprintf(msg, "Could not open %s in read_trace", path);
-	unix_error(msg);
-    }
-    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
-    fscanf(tracefile, "%d", &(trace->num_ids));     
-    fscanf(tracefile, "%d", &(trace->num_ops));     
-    fscanf(tracefile, "%d", &(trace->weight));        /* not used */
-    
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops = 
-	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-	unix_error("malloc 2 failed in read_trace");
-
-    /* We'll keep an array of pointers to the allocated blocks here... */
-    if ((trace->blocks = 
-	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
-	unix_error("malloc 3 failed in read_trace");
-
-    /* ... along with the corresponding byte sizes of each block */
-    if ((trace->block_sizes = 
-	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
-	unix_error("malloc 4 failed in read_trace");
-    
-    /* read every request line in the trace file */
-    index = 0;
-    op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
-	switch(type[0]) {
-	case 'a':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = ALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'r':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = REALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'f':
-	    fscanf(tracefile, "%ud", &index);
-	    trace->ops[op_index].type = FREE;
-	    trace->ops[op_index].index = index;
-	    break;
-	default:
-	    printf("Bogus type character (%c) in tracefile %s\n", 
-		   type[0], path);
-	    exit(1);
+    for (b = 0; b < suite->num_sysallocs; b++) {
+	sysalloc = suite->sysallocs[b];
+	stats = &suite->sys_stats[b][i];
+	if (verbose > 1)
+	    printf("\nTesting %s malloc\n", sysalloc->name);
+	stats->ops = trace->num_reqs;
+	if (verbose > 1)
+	    printf("Checking %s malloc for correctness, ", sysalloc->name);
+	stats->valid = eval_libc_valid(trace, i);
+	if (stats->valid) {
+	    speed_params.trace = trace;
+	    speed_params.touch = 0;
+	    if (verbose > 1)
+		printf("and performance.\n");
+	    stats->secs = time_runs(eval_libc_speed, &speed_params, stats);
+	    if (touch_percent) {
+		speed_params.touch = 1;
+		stats->touch_secs = fsecs(eval_libc_speed, &speed_params);
+		speed_params.touch = 0;
+	    }
+	    if (count_events)
+		stats->events = count_perf(eval_libc_speed, &speed_params,
+					   trace->num_reqs);
 	}
-	op_index++;
-	
     }
-    fclose(tracefile);
-    assert(max_index == trace->num_ids - 1);
-    assert(trace->num_ops == op_index);
-    
-    return trace;
+
+    for (b = 0; b < suite->num_backends; b++) {
+	int errs = errors;
+
+	if (verbose > 1)
+	    printf("\nTesting %s malloc\n", suite->backends[b]->name);
+	backend = suite->backends[b];
+	eval_mm(trace, i, &suite->mm_stats[b][i], ranges, suite->latency,
+		suite->jobs);
+	suite->mm_errors[b] += errors - errs;
+    }
+    free_trace(trace);
 }
 
 /*
- * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ * time_runs - Time a speed function -r times with fsecs, each of which
+ *     is the K-best of several runs itself, and return the mean
  */
-void free_trace(trace_t *trace)
+static double time_runs(fsecs_test_funct f, speed_t *speed_params, stats_t *stats)
 {
-    free(trace->ops);         /* free the three arrays... */
-    free(trace->blocks);      
-    free(trace->block_sizes);
-    free(trace);              /* and the trace record itself... */
+    double secs = 0;
+    int r;
+
+    for (r = 0; r < num_runs; r++) {
+	stats->run_secs[r] = fsecs(f, speed_params);
+	secs += stats->run_secs[r];
+    }
+    stats->runs = num_runs;
+    return secs / num_runs;
 }
 
-/**********************************************************************
- * The following functions evaluate the correctness, space utilization,
- * and throughput of the libc and mm malloc packages.
- **********************************************************************/
+/*
+ * count_perf - One more pass of a speed function, counting the
+ *     hardware events per op (-1 for the events that can't be counted)
+ */
+static double *count_perf(perf_test_funct f, speed_t *speed_params,
+			  int num_ops)
+{
+    double *events;
+    int e;
+
+    if ((events = (double *)malloc(PERF_NUM_EVENTS * sizeof(double))) == NULL)
+	unix_error("events malloc in count_perf failed");
+    fperf(f, speed_params, events);
+    for (e = 0; e < PERF_NUM_EVENTS; e++)
+	if (events[e] >= 0 && num_ops > 0)
+	    events[e] /= num_ops;
+    return events;
+}
 
 /*
  * eval_mm_valid - Check the mm malloc package for correctness
  */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) 
 {
-    int i, j;
-    int index;
+    int i, j, n;
+    int index, count;
     int size;
     int oldsize;
     char *newp;
@@ -597,13 +1145,13 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     clear_ranges(ranges);
 
     /* Call the mm package's init function */
-    if (mm_init() < 0) {
+    if (backend->init() < 0) {
 	malloc_error(tracenum, 0, "mm_init failed.");
 	return 0;
     }
 
     /* Interpret each operation in the trace in order */
-    for (i = 0;  i < trace->num_ops;  i++) {
+    for (i = 0, n = 0;  i < trace->num_ops;  i += TRACE_RECS(&trace->ops[i]), n++) {
 	index = trace->ops[i].index;
 	size = trace->ops[i].size;
 
@@ -612,8 +1160,8 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
         case ALLOC: /* mm_malloc */
 
 	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
-		malloc_error(tracenum, i, "mm_malloc failed.");
+	    if ((p = backend->malloc(size)) == NULL) {
+		malloc_error(tracenum, n, "mm_malloc failed.");
 		return 0;
 	    }
 	    
@@ -622,7 +1170,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	     * to the range list if OK. The block must be  be aligned properly,
 	     * and must not overlap any currently allocated block. 
 	     */ 
-	    if (add_range(ranges, p, size, tracenum, i) == 0)
+	    if (add_range(ranges, p, size, ALIGNMENT, tracenum, n) == 0)
 		return 0;
 	    
 	    /* ADDED: cgw
@@ -637,12 +1185,43 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    trace->block_sizes[index] = size;
 	    break;
 
+        case ALLOC_ALIGNED: /* mm_memalign */
+	    if ((p = aligned_malloc(TRACE_COUNT(&trace->ops[i]), size)) == NULL) {
+		malloc_error(tracenum, n, backend->memalign == NULL ?
+			     "the package has no mm_memalign." :
+			     "mm_memalign failed.");
+		return 0;
+	    }
+	    if (add_range(ranges, p, size, TRACE_COUNT(&trace->ops[i]), tracenum, n) == 0)
+		return 0;
+	    memset(p, index & 0xFF, size);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
+        case ALLOC_BATCH: /* mm_malloc_batch */
+	    count = TRACE_COUNT(&trace->ops[i]);
+	    if (batch_malloc(size, trace->blocks + index, count) != count) {
+		malloc_error(tracenum, n, "mm_malloc_batch failed.");
+		return 0;
+	    }
+
+	    /* Every block of the batch is checked like a single one */
+	    for (j = index; j < index + count; j++) {
+		p = trace->blocks[j];
+		if (add_range(ranges, p, size, ALIGNMENT, tracenum, n) == 0)
+		    return 0;
+		memset(p, j & 0xFF, size);
+		trace->block_sizes[j] = size;
+	    }
+	    break;
+
         case REALLOC: /* mm_realloc */
 	    
 	    /* Call the student's realloc */
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp, size)) == NULL) {
-		malloc_error(tracenum, i, "mm_realloc failed.");
+	    if ((newp = sized_realloc(trace, index, size)) == NULL) {
+		malloc_error(tracenum, n, "mm_realloc failed.");
 		return 0;
 	    }
 	    
@@ -650,7 +1229,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    remove_range(ranges, oldp);
 	    
 	    /* Check new block for correctness and add it to range list */
-	    if (add_range(ranges, newp, size, tracenum, i) == 0)
+	    if (add_range(ranges, newp, size, ALIGNMENT, tracenum, n) == 0)
 		return 0;
 	    
 	    /* ADDED: cgw
@@ -661,8 +1240,8 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
-		malloc_error(tracenum, i, "mm_realloc did not preserve the "
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
+		malloc_error(tracenum, n, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
 	      }
@@ -679,13 +1258,23 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    /* Remove region from list and call student's free function */
 	    p = trace->blocks[index];
 	    remove_range(ranges, p);
-	    mm_free(p);
+	    sized_free(trace, index);
+	    break;
+
+        case FREE_BATCH: /* mm_free_batch */
+	    count = TRACE_COUNT(&trace->ops[i]);
+	    for (j = index; j < index + count; j++)
+		remove_range(ranges, trace->blocks[j]);
+	    batch_free(trace->blocks + index, count);
 	    break;
 
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
 
+	/* Let the package check its own heap (-c) */
+	if (check_heap && backend->checkheap != NULL)
+	    backend->checkheap(0);
     }
 
     /* As far as we know, this is a valid malloc package */
@@ -703,29 +1292,54 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   is always the high water mark of the heap. 
  *   
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			   stats_t *stats)
 {   
-    int i;
-    int index;
+    int i, j, n;
+    int index, count;
     int size, newsize, oldsize;
     int max_total_size = 0;
     int total_size = 0;
     char *p;
-    char *newp, *oldp;
+    char *newp;
+    int sample = (trace->num_ops + RESIDENT_SAMPLES - 1) / RESIDENT_SAMPLES;
+    int samples = 0;
+    double resident;
+    unsigned long long start = 0, cycles = 0; /* of the requests since the last -s sample */
 
-    /* initialize the heap and the mm malloc package */
+    /* initialize the heap and the mm malloc package, with no page in memory */
     mem_reset_brk();
-    if (mm_init() < 0)
+    mem_release(mem_heap_lo(), MAX_HEAP);
+    if (backend->init() < 0)
 	app_error("mm_init failed in eval_mm_util");
+    stats->resident_max = stats->resident_avg = 0;
+
+    /* The -s samples start with the empty heap */
+    if (sample_ops)
+	sample_heap(tracenum, 0, 0, 0);
+
+    for (i = 0, n = 0;  i < trace->num_ops;  i += TRACE_RECS(&trace->ops[i]), n++) {
+	/* Sample the heap bytes in memory every so often */
+	if (n % sample == 0) {
+	    resident = mem_resident();
+	    stats->resident_max = (resident > stats->resident_max) ?
+		resident : stats->resident_max;
+	    stats->resident_avg += resident;
+	    samples++;
+	}
+
+	if (sample_ops)
+	    start = read_counter();
 
-    for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_alloc */
+        case ALLOC_ALIGNED: /* mm_memalign */
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    if ((p = (trace->ops[i].type == ALLOC) ? backend->malloc(size) :
+		 aligned_malloc(TRACE_COUNT(&trace->ops[i]), size)) == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
@@ -741,13 +1355,27 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 		total_size : max_total_size;
 	    break;
 
-	case REALLOC: /* mm_realloc */
+        case ALLOC_BATCH: /* mm_malloc_batch */
 	    index = trace->ops[i].index;
-	    newsize = trace->ops[i].size;
-	    oldsize = trace->block_sizes[index];
+	    size = trace->ops[i].size;
+	    count = TRACE_COUNT(&trace->ops[i]);
 
-	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp,newsize)) == NULL)
+	    if (batch_malloc(size, trace->blocks + index, count) != count)
+		app_error("mm_malloc_batch failed in eval_mm_util");
+	    for (j = index; j < index + count; j++)
+		trace->block_sizes[j] = size;
+
+	    total_size += size * count;
+	    max_total_size = (total_size > max_total_size) ?
+		total_size : max_total_size;
+	    break;
+
+	case REALLOC: /* mm_realloc */
+	    index = trace->ops[i].index;
+	    newsize = trace->ops[i].size;
+	    oldsize = trace->block_sizes[index];
+
+	    if ((newp = sized_realloc(trace, index, newsize)) == NULL)
 		app_error("mm_realloc failed in eval_mm_util");
 
 	    /* Remember region and size */
@@ -766,9 +1394,8 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
         case FREE: /* mm_free */
 	    index = trace->ops[i].index;
 	    size = trace->block_sizes[index];
-	    p = trace->blocks[index];
 	    
-	    mm_free(p);
+	    sized_free(trace, index);
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
@@ -776,97 +1403,899 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    break;
 
+        case FREE_BATCH: /* mm_free_batch */
+	    index = trace->ops[i].index;
+	    count = TRACE_COUNT(&trace->ops[i]);
+	    for (j = index; j < index + count; j++)
+		total_size -= trace->block_sizes[j];
+	    batch_free(trace->blocks + index, count);
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_util");
 
         }
+
+	/* 
+	 * And the heap layout after every sample_ops requests and after
+	 * the last one, with the cycles the requests since took
+	 */
+	if (sample_ops) {
+	    cycles += read_counter() - start;
+	    if ((n + 1) % sample_ops == 0 ||
+		i + TRACE_RECS(&trace->ops[i]) == trace->num_ops) {
+		sample_heap(tracenum, n + 1, total_size,
+			    (double)cycles/(n % sample_ops + 1));
+		cycles = 0;
+	    }
+	}
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    /* The end of the trace is a sample too, so even a trace without requests has one */
+    stats->resident_end = mem_resident();
+    stats->resident_max = (stats->resident_end > stats->resident_max) ?
+	stats->resident_end : stats->resident_max;
+    stats->resident_avg = (stats->resident_avg + stats->resident_end) / (samples + 1);
+    stats->heap_peak = mem_peak_heapsize();
+
+    /* The heap may have shrunk since, so we compare with its peak */
+    return ((double)max_total_size / (double)mem_peak_heapsize());
 }
 
 
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
- *    to measure the running time of the mm malloc package.
+ *    to measure the running time of the mm malloc package. If
+ *    hists is set, also records the latency of each request in
+ *    hists[type].
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size, newsize;
-    char *p, *newp, *oldp, *block;
+    int i, j, index, size, newsize, count;
+    char *p, *newp;
+    unsigned long long start = 0;
     trace_t *trace = ((speed_t *)ptr)->trace;
+    hist_t *hists = ((speed_t *)ptr)->hists;
+    int touch = ((speed_t *)ptr)->touch;
 
     /* Reset the heap and initialize the mm package */
     mem_reset_brk();
-    if (mm_init() < 0) 
+    if (backend->init() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
 
     /* Interpret each trace request */
-    for (i = 0;  i < trace->num_ops;  i++)
+    for (i = 0;  i < trace->num_ops;  i += TRACE_RECS(&trace->ops[i])) {
+	if (hists)
+	    start = read_counter();
+
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_malloc */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            if ((p = backend->malloc(size)) == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
+	    if (touch)
+		touch_payload(trace, index, 0, size);
+	    else if (size_hints)
+		trace->block_sizes[index] = size;
+            break;
+
+        case ALLOC_ALIGNED: /* mm_memalign */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if ((p = aligned_malloc(TRACE_COUNT(&trace->ops[i]), size)) == NULL)
+		app_error("mm_memalign error in eval_mm_speed");
+            trace->blocks[index] = p;
+	    if (touch)
+		touch_payload(trace, index, 0, size);
+	    else if (size_hints)
+		trace->block_sizes[index] = size;
+            break;
+
+        case ALLOC_BATCH: /* mm_malloc_batch */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            count = TRACE_COUNT(&trace->ops[i]);
+            if (batch_malloc(size, trace->blocks + index, count) != count)
+		app_error("mm_malloc_batch error in eval_mm_speed");
+	    for (j = index; touch && j < index + count; j++)
+		touch_payload(trace, j, 0, size);
+	    for (j = index; !touch && size_hints && j < index + count; j++)
+		trace->block_sizes[j] = size;
             break;
 
 	case REALLOC: /* mm_realloc */
 	    index = trace->ops[i].index;
             newsize = trace->ops[i].size;
-	    oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL)
+            if ((newp = sized_realloc(trace, index, newsize)) == NULL)
 		app_error("mm_realloc error in eval_mm_speed");
             trace->blocks[index] = newp;
+	    if (touch)
+		touch_payload(trace, index, trace->block_sizes[index], newsize);
+	    else if (size_hints)
+		trace->block_sizes[index] = newsize;
             break;
 
         case FREE: /* mm_free */
             index = trace->ops[i].index;
-            block = trace->blocks[index];
-            mm_free(block);
+	    if (touch && touch_read)
+		read_payload(trace, index);
+            sized_free(trace, index);
+            break;
+
+        case FREE_BATCH: /* mm_free_batch */
+            index = trace->ops[i].index;
+            count = TRACE_COUNT(&trace->ops[i]);
+	    for (j = index; touch && touch_read && j < index + count; j++)
+		read_payload(trace, j);
+            batch_free(trace->blocks + index, count);
             break;
 
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
+
+	if (hists)
+	    hist_add(&hists[trace->ops[i].type], read_counter() - start);
+    }
+}
+
+/*
+ * touch_payload - Write touch_percent percent of a block payload, the
+ *     way a program fills in an object it just allocated. After a
+ *     realloc only the bytes beyond the old size are new. The size
+ *     is remembered for read_payload.
+ */
+static void touch_payload(trace_t *trace, int index, int oldsize, int size)
+{
+    int from = (int)(((long)oldsize * touch_percent + 99) / 100);
+    int to = (int)(((long)size * touch_percent + 99) / 100);
+
+    if (to > from)
+	memset(trace->blocks[index] + from, index & 0xFF, to - from);
+    trace->block_sizes[index] = size;
+}
+
+/*
+ * read_payload - Read back the bytes of a block touch_payload wrote,
+ *     a word at a time, before the block is freed
+ */
+static void read_payload(trace_t *trace, int index)
+{
+    char *p = trace->blocks[index];
+    int n = (int)(((long)trace->block_sizes[index] * touch_percent + 99) / 100);
+    unsigned long sum = 0, word;
+    int i;
+
+    for (i = 0; i + (int)sizeof(word) <= n; i += sizeof(word)) {
+	memcpy(&word, p + i, sizeof(word));
+	sum += word;
+    }
+    for (; i < n; i++)
+	sum += (unsigned char)p[i];
+    touch_sum += sum;
+}
+
+/*
+ * batch_malloc - Allocate n blocks of size bytes with the backend's
+ *     batch entry point, or one at a time if it has none. Returns the
+ *     number of blocks allocated.
+ */
+static int batch_malloc(size_t size, char **blocks, int n)
+{
+    int i;
+
+    if (backend->malloc_batch != NULL)
+	return backend->malloc_batch(size, (void **)blocks, n);
+    for (i = 0; i < n; i++)
+	if ((blocks[i] = backend->malloc(size)) == NULL)
+	    break;
+    return i;
+}
+
+/*
+ * batch_free - Free n blocks with the backend's batch entry point, or
+ *     one at a time. The order of blocks is lost.
+ */
+static void batch_free(char **blocks, int n)
+{
+    int i;
+
+    if (backend->free_batch != NULL) {
+	backend->free_batch((void **)blocks, n);
+	return;
+    }
+    for (i = 0; i < n; i++)
+	backend->free(blocks[i]);
+}
+
+/*
+ * aligned_malloc - Allocate an aligned block with the backend's
+ *     memalign, NULL if it has none
+ */
+static char *aligned_malloc(size_t align, size_t size)
+{
+    if (backend->memalign == NULL)
+	return NULL;
+    return backend->memalign(align, size);
+}
+
+/*
+ * sized_free - Free block index of the trace. With -z the backend's
+ *     sized free is told the size it was last given, if it has one.
+ */
+static void sized_free(trace_t *trace, int index)
+{
+    if (size_hints && backend->free_sized != NULL)
+	backend->free_sized(trace->blocks[index], trace->block_sizes[index]);
+    else
+	backend->free(trace->blocks[index]);
+}
+
+/*
+ * sized_realloc - Resize block index of the trace, the same way
+ */
+static char *sized_realloc(trace_t *trace, int index, int size)
+{
+    if (size_hints && backend->realloc_sized != NULL)
+	return backend->realloc_sized(trace->blocks[index],
+				      trace->block_sizes[index], size);
+    return backend->realloc(trace->blocks[index], size);
+}
+
+#if MM_THREADSAFE
+/*
+ * eval_mm_mt - Replay a trace on 1..jobs threads at once against the
+ *    thread safe mm package and print the scaling curve. The ids of
+ *    the trace are split into one shard per thread, so every thread 
+ *    replays its own blocks in trace order. If xfree is set, a thread
+ *    does not free its blocks itself but hands them to the next thread 
+ *    (producer/consumer), so every free is a cross-thread free. With -p 
+ *    the threads are spread over the NUMA nodes and one more replay on 
+ *    jobs threads tells how many blocks were on the thread's node.
+ */
+static void eval_mm_mt(trace_t *trace, int tracenum, int jobs, int xfree)
+{
+    mt_thread_t *threads;
+    double secs, base = 0;
+    int n, t, run;
+
+    if ((threads = (mt_thread_t *)calloc(jobs, sizeof(mt_thread_t))) == NULL)
+	unix_error("calloc failed in eval_mm_mt");
+
+    printf("\nTrace %d on 1..%d threads, %s:\n", tracenum, jobs,
+	   xfree ? "blocks freed by the next thread" : "each thread frees its own blocks");
+    printf("%7s%10s%8s  %s\n", "threads", "Kops", "speedup", "Kops per thread");
+
+    for (n = 1; n <= jobs; n++) {
+	/* Keep the fastest of MT_RUNS runs, like the K-best scheme */
+	secs = DBL_MAX;
+	for (run = 0; run < MT_RUNS; run++) {
+	    double s = mt_replay(trace, n, xfree, threads);
+	    if (s < secs)
+		secs = s;
+	}
+	if (n == 1)
+	    base = secs;
+
+	printf("%7d%10.0f%8.2f ", n, (trace->num_reqs/1e3)/secs, base/secs);
+	for (t = 0; t < n; t++)
+	    printf(" %6.0f", (threads[t].num_reqs/1e3)/threads[t].secs);
+	printf("\n");
+    }
+    if (pin_threads)
+	mt_locality(trace, jobs, xfree, threads);
+
+    for (t = 0; t < jobs; t++)
+	free(threads[t].ops);
+    free(threads);
+}
+
+/* Number of threads of a replay still working on their shard */
+static int mt_producing;
+
+/*
+ * mt_replay - Split the trace into nthreads shards by id, replay the 
+ *    shards at the same time and return the elapsed wall clock time 
+ */
+static double mt_replay(trace_t *trace, int nthreads, int xfree, mt_thread_t *threads)
+{
+    pthread_t *tids;
+    mt_queue_t *queues;
+    struct timeval stv, etv;
+    traceop_t op;
+    int i, j, t, recs;
+
+    tids = (pthread_t *)malloc(nthreads * sizeof(pthread_t));
+    queues = (mt_queue_t *)calloc(nthreads, sizeof(mt_queue_t));
+    if (tids == NULL || queues == NULL)
+	unix_error("malloc failed in mt_replay");
+
+    /* A shard splits the batches, only an aligned alloc keeps its ARG record */
+    for (i = 0, recs = trace->num_reqs; i < trace->num_ops; i += TRACE_RECS(&trace->ops[i]))
+	if (trace->ops[i].type == ALLOC_ALIGNED)
+	    recs++;
+
+    /* Give every thread the requests of the ids that map to it */
+    for (t = 0; t < nthreads; t++) {
+	free(threads[t].ops);
+	threads[t].trace = trace;
+	threads[t].num_ops = threads[t].num_reqs = 0;
+	threads[t].xfree = xfree;
+	threads[t].in = &queues[t];
+	threads[t].out = &queues[(t + 1) % nthreads];
+	threads[t].cpus = pin_threads ? &node_cpus[t % num_nodes] : NULL;
+	threads[t].local_allocs = threads[t].remote_allocs = 0;
+	threads[t].remote_frees = 0;
+	if ((threads[t].ops = (traceop_t *)malloc(recs * sizeof(traceop_t))) == NULL)
+	    unix_error("malloc failed in mt_replay");
+    }
+    for (i = 0; i < trace->num_ops; i += TRACE_RECS(&trace->ops[i])) {
+	op = trace->ops[i];
+	if (op.type == ALLOC_BATCH || op.type == FREE_BATCH) {
+	    /* The ids of a batch go to different shards, one at a time */
+	    op.type = (op.type == ALLOC_BATCH) ? ALLOC : FREE;
+	    if (op.type == FREE)
+		op.size = 0;
+	    for (j = 0; j < (int)TRACE_COUNT(&trace->ops[i]); j++, op.index++) {
+		t = op.index % nthreads;
+		threads[t].ops[threads[t].num_ops++] = op;
+		threads[t].num_reqs++;
+	    }
+	    continue;
+	}
+	t = op.index % nthreads;
+	threads[t].ops[threads[t].num_ops++] = op;
+	if (op.type == ALLOC_ALIGNED)
+	    threads[t].ops[threads[t].num_ops++] = trace->ops[i + 1];
+	threads[t].num_reqs++;
+    }
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (backend->init() < 0) 
+	app_error("mm_init failed in mt_replay");
+
+    mt_producing = nthreads;
+    gettimeofday(&stv, NULL);
+    for (t = 0; t < nthreads; t++)
+	if (pthread_create(&tids[t], NULL, mt_thread, &threads[t]) != 0)
+	    unix_error("pthread_create failed in mt_replay");
+    for (t = 0; t < nthreads; t++)
+	pthread_join(tids[t], NULL);
+    gettimeofday(&etv, NULL);
+
+    /* Blocks still cached by the exited threads went back to the heap */
+    free(tids);
+    free(queues);
+    return (etv.tv_sec - stv.tv_sec) + 1E-6*(etv.tv_usec - stv.tv_usec);
+}
+
+/*
+ * mt_thread - Replay one shard of a trace 
+ */
+static void *mt_thread(void *ptr)
+{
+    mt_thread_t *thread = (mt_thread_t *)ptr;
+    char **blocks = thread->trace->blocks;
+    mt_queue_t *out = thread->out;
+    struct timeval stv, etv;
+    char *p;
+    int i;
+
+    /* Pinned before the first request, so mm picks the heap of the node */
+    if (thread->cpus != NULL &&
+	pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), thread->cpus) != 0)
+	app_error("pthread_setaffinity_np failed in mt_thread");
+
+    gettimeofday(&stv, NULL);
+
+    for (i = 0;  i < thread->num_ops;  i += TRACE_RECS(&thread->ops[i])) {
+        switch (thread->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+            if ((p = backend->malloc(thread->ops[i].size)) == NULL)
+		app_error("mm_malloc error in mt_thread");
+            blocks[thread->ops[i].index] = p;
+	    if (thread->locality)
+		mt_count_alloc(thread, p);
+            break;
+
+        case ALLOC_ALIGNED: /* mm_memalign */
+            if ((p = aligned_malloc(TRACE_COUNT(&thread->ops[i]), thread->ops[i].size)) == NULL)
+		app_error("mm_memalign error in mt_thread");
+            blocks[thread->ops[i].index] = p;
+	    if (thread->locality)
+		mt_count_alloc(thread, p);
+            break;
+
+	case REALLOC: /* mm_realloc */
+            if ((p = backend->realloc(blocks[thread->ops[i].index], thread->ops[i].size)) == NULL)
+		app_error("mm_realloc error in mt_thread");
+            blocks[thread->ops[i].index] = p;
+	    if (thread->locality)
+		mt_count_alloc(thread, p);
+            break;
+
+        case FREE: /* mm_free, possibly by the next thread */
+	    if (!thread->xfree) {
+		mt_free(thread, blocks[thread->ops[i].index]);
+		break;
+	    }
+	    while (__atomic_load_n(&out->tail, __ATOMIC_RELAXED) -
+		   __atomic_load_n(&out->head, __ATOMIC_ACQUIRE) == MT_QUEUE_SIZE) {
+		/* The next thread is behind, do our own share meanwhile */
+		mt_drain(thread);
+		sched_yield();
+	    }
+	    out->slots[out->tail % MT_QUEUE_SIZE] = blocks[thread->ops[i].index];
+	    __atomic_store_n(&out->tail, out->tail + 1, __ATOMIC_RELEASE);
+            break;
+
+	default:
+	    app_error("Nonexistent request type in mt_thread");
+        }
+
+	if (thread->xfree)
+	    mt_drain(thread);
+    }
+
+    /* Keep freeing what the previous thread sends until everyone is done */
+    __atomic_sub_fetch(&mt_producing, 1, __ATOMIC_SEQ_CST);
+    while (thread->xfree && __atomic_load_n(&mt_producing, __ATOMIC_SEQ_CST) > 0) {
+	mt_drain(thread);
+	sched_yield();
+    }
+    if (thread->xfree)
+	mt_drain(thread);
+
+    gettimeofday(&etv, NULL);
+    thread->secs = (etv.tv_sec - stv.tv_sec) + 1E-6*(etv.tv_usec - stv.tv_usec);
+    return NULL;
+}
+
+/*
+ * mt_drain - Free all blocks waiting in the queue of a thread
+ */
+static void mt_drain(mt_thread_t *thread)
+{
+    mt_queue_t *queue = thread->in;
+    unsigned long tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+    unsigned long head = queue->head;
+
+    if (head == tail)
+	return;
+    while (head != tail)
+	mt_free(thread, queue->slots[head++ % MT_QUEUE_SIZE]);
+    __atomic_store_n(&queue->head, head, __ATOMIC_RELEASE);
+}
+
+/*
+ * mt_locality - Replay a trace once more on nthreads threads, looking 
+ *    up the node of the page of every block, and print how many of the
+ *    blocks were on the node of the thread that got them and how many 
+ *    were freed from another node. Blocks on a page the kernel can't 
+ *    place count as neither.
+ */
+static void mt_locality(trace_t *trace, int nthreads, int xfree, mt_thread_t *threads)
+{
+    long local = 0, remote = 0, remote_frees = 0, frees = 0;
+    int t;
+
+    for (t = 0; t < nthreads; t++)
+	threads[t].locality = 1;
+    mt_replay(trace, nthreads, xfree, threads);
+    for (t = 0; t < nthreads; t++) {
+	threads[t].locality = 0;
+	local += threads[t].local_allocs;
+	remote += threads[t].remote_allocs;
+	remote_frees += threads[t].remote_frees;
+    }
+    for (t = 0; t < trace->num_ops; t += TRACE_RECS(&trace->ops[t]))
+	if (trace->ops[t].type == FREE || trace->ops[t].type == FREE_BATCH)
+	    frees += TRACE_REQS(&trace->ops[t]);
+
+    printf("%7s  %.1f%% local, %.1f%% remote blocks, %.1f%% remote frees on %d node%s\n",
+	   "numa", 
+	   (local + remote) ? 100.0*local/(local + remote) : 0.0,
+	   (local + remote) ? 100.0*remote/(local + remote) : 0.0,
+	   frees ? 100.0*remote_frees/frees : 0.0,
+	   num_nodes, num_nodes > 1 ? "s" : "");
+}
+
+/*
+ * mt_count_alloc - Count a block a thread got as local or remote, by 
+ *    the node of the page of its first byte
+ */
+static void mt_count_alloc(mt_thread_t *thread, char *p)
+{
+    int node = page_node(p);
+
+    if (node < 0)
+	return;
+    if (node == cpu_node())
+	thread->local_allocs++;
+    else
+	thread->remote_allocs++;
+}
+
+/*
+ * mt_free - Free a block for a thread, counting it if it is on another
+ *    node's page
+ */
+static void mt_free(mt_thread_t *thread, char *p)
+{
+    int node;
+
+    if (thread->locality && (node = page_node(p)) >= 0 && node != cpu_node())
+	thread->remote_frees++;
+    backend->free(p);
+}
+
+/*
+ * node_cpus_init - Read the CPUs of each NUMA node for -p. Without the
+ *    node lists of sysfs all CPUs we may run on form one node. Returns 
+ *    the number of nodes.
+ */
+static int node_cpus_init(void)
+{
+    char path[MAXLINE], line[MAXLINE];
+    FILE *fp;
+    int n;
+
+    num_nodes = mem_num_nodes();
+    if ((node_cpus = (cpu_set_t *)calloc(num_nodes, sizeof(cpu_set_t))) == NULL)
+	unix_error("calloc failed in node_cpus_init");
+
+    for (n = 0; n < num_nodes; n++) {
+	sprintf(path, NODE_CPUS, n);
+	if ((fp = fopen(path, "r")) == NULL || fgets(line, MAXLINE, fp) == NULL) {
+	    if (fp != NULL)
+		fclose(fp);
+	    if (sched_getaffinity(0, sizeof(cpu_set_t), &node_cpus[0]) < 0)
+		unix_error("sched_getaffinity failed in node_cpus_init");
+	    num_nodes = 1;
+	    return num_nodes;
+	}
+	fclose(fp);
+	parse_cpulist(line, &node_cpus[n]);
+    }
+    return num_nodes;
+}
+
+/*
+ * page_node - Return the NUMA node of the page that holds p, or -1 if 
+ *    the page is not in memory or the kernel can't tell
+ */
+static int page_node(void *p)
+{
+    void *page = (void *)((size_t)p & ~(size_t)(getpagesize() - 1));
+    int status = -1;
+
+    if (syscall(SYS_move_pages, 0, 1UL, &page, NULL, &status, 0) < 0)
+	return -1;
+    return status;
+}
+
+/*
+ * cpu_node - Return the NUMA node the calling thread runs on
+ */
+static int cpu_node(void)
+{
+    unsigned int cpu, node;
+
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) < 0)
+	return 0;
+    return (int)node;
+}
+#endif
+
+/*****************************************************************
+ * The following routines evaluate the traces in worker processes
+ * (-w). The driver hands out the traces one at a time, so a worker
+ * that is done with a short trace takes the next one, and collects
+ * the stats the workers send back through pipes.
+ ****************************************************************/
+
+/*
+ * eval_parallel - Evaluate the traces of a suite in up to workers
+ *     forked processes and fill in the suite's stats arrays
+ */
+static void eval_parallel(suite_t *suite, int workers)
+{
+    worker_t *worker;
+    struct pollfd *pfd;  /* the results pipe of each worker, fd -1 when done */
+    int in[2], out[2];   /* trace numbers to a worker, its results back */
+    int want = suite->num_backends + suite->num_sysallocs;
+    int next = 0, done = 0;
+    int w, v, r;
+
+    if (workers > suite->num_tracefiles)
+	workers = suite->num_tracefiles;
+    worker = (worker_t *)calloc(workers, sizeof(worker_t));
+    pfd = (struct pollfd *)calloc(workers, sizeof(struct pollfd));
+    if (worker == NULL || pfd == NULL)
+	unix_error("calloc failed in eval_parallel");
+
+    /* A dead worker shows up as the end of its results, not as SIGPIPE */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Don't let the children print what is in our buffer again */
+    fflush(stdout);
+    for (w = 0; w < workers; w++) {
+	if (pipe(in) < 0 || pipe(out) < 0)
+	    unix_error("pipe failed in eval_parallel");
+	if ((worker[w].pid = fork()) < 0)
+	    unix_error("fork failed in eval_parallel");
+	if (worker[w].pid == 0) {
+	    /* The pipes of the older workers stay open until they are done */
+	    for (v = 0; v < w; v++) {
+		close(worker[v].cmd);
+		close(pfd[v].fd);
+	    }
+	    close(in[1]);
+	    close(out[0]);
+	    worker_run(suite, w, in[0], out[1]);
+	}
+	close(in[0]);
+	close(out[1]);
+	worker[w].cmd = in[1];
+	pfd[w].fd = out[0];
+	pfd[w].events = POLLIN;
+    }
+
+    /* Hand out a trace to each, and another whenever one is done */
+    for (w = 0; w < workers; w++)
+	hand_out(suite, &worker[w], &pfd[w], &next);
+    while (done < suite->num_tracefiles) {
+	if (poll(pfd, workers, -1) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    unix_error("poll failed in eval_parallel");
+	}
+	for (w = 0; w < workers; w++) {
+	    if (pfd[w].fd < 0 || pfd[w].revents == 0)
+		continue;
+	    for (r = 0; r < want; r++)
+		if (!recv_result(pfd[w].fd, suite))
+		    worker_died(suite, worker, workers, w);
+	    done++;
+	    hand_out(suite, &worker[w], &pfd[w], &next);
+	}
+    }
+
+    for (w = 0; w < workers; w++)
+	waitpid(worker[w].pid, NULL, 0);
+    free(worker);
+    free(pfd);
+}
+
+/*
+ * hand_out - Send a worker the next trace, or close its pipes if
+ *     there is none left, which makes it exit
+ */
+static void hand_out(suite_t *suite, worker_t *worker, struct pollfd *pfd,
+		     int *next)
+{
+    if (*next < suite->num_tracefiles) {
+	worker->tracenum = (*next)++;
+	write_full(worker->cmd, &worker->tracenum, sizeof(int));
+	return;
+    }
+    worker->tracenum = -1;
+    close(worker->cmd);
+    close(pfd->fd);
+    worker->cmd = pfd->fd = -1;
+}
+
+/*
+ * worker_died - Report a worker that exited before it sent all the
+ *     results of its trace, the way the driver would have died on that
+ *     trace if it were evaluated serially, and stop the others
+ */
+static void worker_died(suite_t *suite, worker_t *workers, int num_workers,
+			int w)
+{
+    int status, v;
+
+    for (v = 0; v < num_workers; v++)
+	if (v != w && workers[v].cmd >= 0)
+	    kill(workers[v].pid, SIGKILL);
+    fflush(stdout);
+    if (waitpid(workers[w].pid, &status, 0) == workers[w].pid &&
+	WIFSIGNALED(status))
+	sprintf(msg, "ERROR: worker evaluating %s killed by signal %d",
+		suite->tracefiles[workers[w].tracenum], WTERMSIG(status));
+    else
+	sprintf(msg, "ERROR: worker evaluating %s exited with status %d",
+		suite->tracefiles[workers[w].tracenum], WEXITSTATUS(status));
+    app_error(msg);
+}
+
+/*
+ * worker_run - Body of worker w: evaluates the traces whose numbers it
+ *     reads from fd in, on a heap of its own, and writes their stats to
+ *     fd out until in is closed
+ */
+static void worker_run(suite_t *suite, int w, int in, int out)
+{
+    range_t *ranges = NULL;
+    int i, b;
+
+    mem_deinit();
+    mem_init();
+    close_perf();
+    if (CPU_COUNT(&pin_cpus))
+	pin_cpu(w);
+
+    /* Each trace's messages come out in one piece */
+    setvbuf(stdout, NULL, _IOFBF, BUFSIZ);
+    while (read_full(in, &i, sizeof(i))) {
+	eval_trace(suite, i, &ranges);
+	fflush(stdout);
+	for (b = 0; b < suite->num_sysallocs; b++)
+	    send_result(out, i, -1 - b, 0, &suite->sys_stats[b][i]);
+	for (b = 0; b < suite->num_backends; b++) {
+	    send_result(out, i, b, suite->mm_errors[b], &suite->mm_stats[b][i]);
+	    suite->mm_errors[b] = 0;
+	}
+    }
+    exit(0);
+}
+
+/*
+ * send_result - Write the stats of package pkg on a trace to fd,
+ *     followed by its latencies and events if it has them
+ */
+static void send_result(int fd, int tracenum, int pkg, int errs,
+			stats_t *stats)
+{
+    result_t result;
+
+    result.tracenum = tracenum;
+    result.pkg = pkg;
+    result.errors = errs;
+    result.stats = *stats;
+    write_full(fd, &result, sizeof(result));
+    if (stats->latency != NULL)
+	write_full(fd, stats->latency, NUM_OPTYPES * sizeof(hist_t));
+    if (stats->events != NULL)
+	write_full(fd, stats->events, PERF_NUM_EVENTS * sizeof(double));
+}
+
+/*
+ * recv_result - Read the stats send_result wrote into the suite's
+ *     arrays, returns 0 if the worker exited before it was all there
+ */
+static int recv_result(int fd, suite_t *suite)
+{
+    result_t result;
+    stats_t *stats;
+
+    if (!read_full(fd, &result, sizeof(result)))
+	return 0;
+    if (result.pkg < 0)
+	stats = &suite->sys_stats[-1 - result.pkg][result.tracenum];
+    else {
+	stats = &suite->mm_stats[result.pkg][result.tracenum];
+	suite->mm_errors[result.pkg] += result.errors;
+    }
+    *stats = result.stats;
+
+    if (stats->latency != NULL) {
+	stats->latency = (hist_t *)malloc(NUM_OPTYPES * sizeof(hist_t));
+	if (stats->latency == NULL)
+	    unix_error("latency malloc in recv_result failed");
+	if (!read_full(fd, stats->latency, NUM_OPTYPES * sizeof(hist_t)))
+	    return 0;
+    }
+    if (stats->events != NULL) {
+	stats->events = (double *)malloc(PERF_NUM_EVENTS * sizeof(double));
+	if (stats->events == NULL)
+	    unix_error("events malloc in recv_result failed");
+	if (!read_full(fd, stats->events, PERF_NUM_EVENTS * sizeof(double)))
+	    return 0;
+    }
+    return 1;
+}
+
+/*
+ * read_full - Read n bytes from a pipe, returns 0 if it was closed first
+ */
+static int read_full(int fd, void *buf, size_t n)
+{
+    ssize_t r;
+
+    while (n > 0) {
+	if ((r = read(fd, buf, n)) < 0 && errno != EINTR)
+	    unix_error("read failed in read_full");
+	if (r == 0)
+	    return 0;
+	if (r > 0) {
+	    buf = (char *)buf + r;
+	    n -= r;
+	}
+    }
+    return 1;
+}
+
+/*
+ * write_full - Write n bytes to a pipe
+ */
+static void write_full(int fd, void *buf, size_t n)
+{
+    ssize_t r;
+
+    while (n > 0) {
+	if ((r = write(fd, buf, n)) < 0 && errno != EINTR)
+	    unix_error("write failed in write_full");
+	if (r > 0) {
+	    buf = (char *)buf + r;
+	    n -= r;
+	}
+    }
 }
 
 /*
  * eval_libc_valid - We run this function to make sure that the
- *    libc malloc can run to completion on the set of traces.
- *    We'll be conservative and terminate if any libc malloc call fails.
- *
+ *    libc malloc (or another outside package, see sysalloc_t) can run
+ *    to completion on the set of traces. We'll be conservative and
+ *    terminate if any of its malloc calls fails.
  */
 static int eval_libc_valid(trace_t *trace, int tracenum)
 {
-    int i, newsize;
+    int i, j, n, newsize;
     char *p, *newp, *oldp;
 
-    for (i = 0;  i < trace->num_ops;  i++) {
+    for (i = 0, n = 0;  i < trace->num_ops;  i += TRACE_RECS(&trace->ops[i]), n++) {
         switch (trace->ops[i].type) {
 
         case ALLOC: /* malloc */
-	    if ((p = malloc(trace->ops[i].size)) == NULL) {
-		malloc_error(tracenum, i, "libc malloc failed");
+	    if ((p = sysalloc->malloc(trace->ops[i].size)) == NULL) {
+		malloc_error(tracenum, n, "malloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+        case ALLOC_ALIGNED: /* posix_memalign */
+	    if (sysalloc->posix_memalign((void **)&p, TRACE_COUNT(&trace->ops[i]),
+			       trace->ops[i].size) != 0) {
+		malloc_error(tracenum, n, "posix_memalign failed");
 		unix_error("System message");
 	    }
 	    trace->blocks[trace->ops[i].index] = p;
 	    break;
 
+        case ALLOC_BATCH: /* malloc, malloc(3) has no batches */
+	    for (j = 0; j < (int)TRACE_COUNT(&trace->ops[i]); j++) {
+		if ((p = sysalloc->malloc(trace->ops[i].size)) == NULL) {
+		    malloc_error(tracenum, n, "malloc failed");
+		    unix_error("System message");
+		}
+		trace->blocks[trace->ops[i].index + j] = p;
+	    }
+	    break;
+
 	case REALLOC: /* realloc */
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[trace->ops[i].index];
-	    if ((newp = realloc(oldp, newsize)) == NULL) {
-		malloc_error(tracenum, i, "libc realloc failed");
+	    if ((newp = sysalloc->realloc(oldp, newsize)) == NULL) {
+		malloc_error(tracenum, n, "realloc failed");
 		unix_error("System message");
 	    }
 	    trace->blocks[trace->ops[i].index] = newp;
 	    break;
 	    
         case FREE: /* free */
-	    free(trace->blocks[trace->ops[i].index]);
+	    sysalloc->free(trace->blocks[trace->ops[i].index]);
+	    break;
+
+        case FREE_BATCH: /* free */
+	    for (j = 0; j < (int)TRACE_COUNT(&trace->ops[i]); j++)
+		sysalloc->free(trace->blocks[trace->ops[i].index + j]);
 	    break;
 
 	default:
@@ -879,66 +2308,631 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 
 /* 
  * eval_libc_speed - This is the function that is used by fcyc() to
- *    measure the running time of the libc malloc package on the set
- *    of traces.
+ *    measure the running time of the libc malloc package (or another
+ *    outside package) on the set of traces.
  */
 static void eval_libc_speed(void *ptr)
 {
-    int i;
+    int i, j;
     int index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
+    int touch = ((speed_t *)ptr)->touch;
 
-    for (i = 0;  i < trace->num_ops;  i++) {
+    for (i = 0;  i < trace->num_ops;  i += TRACE_RECS(&trace->ops[i])) {
         switch (trace->ops[i].type) {
         case ALLOC: /* malloc */
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
-	    if ((p = malloc(size)) == NULL)
+	    if ((p = sysalloc->malloc(size)) == NULL)
 		unix_error("malloc failed in eval_libc_speed");
 	    trace->blocks[index] = p;
+	    if (touch)
+		touch_payload(trace, index, 0, size);
+	    break;
+
+        case ALLOC_ALIGNED: /* posix_memalign */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if (sysalloc->posix_memalign((void **)&p, TRACE_COUNT(&trace->ops[i]), size) != 0)
+		unix_error("posix_memalign failed in eval_libc_speed");
+	    trace->blocks[index] = p;
+	    if (touch)
+		touch_payload(trace, index, 0, size);
+	    break;
+
+        case ALLOC_BATCH: /* malloc */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    for (j = index; j < index + (int)TRACE_COUNT(&trace->ops[i]); j++) {
+		if ((p = sysalloc->malloc(size)) == NULL)
+		    unix_error("malloc failed in eval_libc_speed");
+		trace->blocks[j] = p;
+		if (touch)
+		    touch_payload(trace, j, 0, size);
+	    }
 	    break;
 
 	case REALLOC: /* realloc */
 	    index = trace->ops[i].index;
 	    newsize = trace->ops[i].size;
 	    oldp = trace->blocks[index];
-	    if ((newp = realloc(oldp, newsize)) == NULL)
+	    if ((newp = sysalloc->realloc(oldp, newsize)) == NULL)
 		unix_error("realloc failed in eval_libc_speed\n");
 	    
 	    trace->blocks[index] = newp;
+	    if (touch)
+		touch_payload(trace, index, trace->block_sizes[index], newsize);
 	    break;
 	    
         case FREE: /* free */
 	    index = trace->ops[i].index;
 	    block = trace->blocks[index];
-	    free(block);
+	    if (touch && touch_read)
+		read_payload(trace, index);
+	    sysalloc->free(block);
+	    break;
+
+        case FREE_BATCH: /* free */
+	    index = trace->ops[i].index;
+	    for (j = index; j < index + (int)TRACE_COUNT(&trace->ops[i]); j++) {
+		if (touch && touch_read)
+		    read_payload(trace, j);
+		sysalloc->free(trace->blocks[j]);
+	    }
 	    break;
 	}
     }
 }
 
+/*
+ * load_sysalloc - Load the malloc package of a shared library for -D,
+ *     given as path[:prefix] if its functions are named like
+ *     prefixmalloc. Returns NULL if it can't be loaded.
+ */
+static sysalloc_t *load_sysalloc(char *spec)
+{
+    char path[MAXLINE], sym[MAXLINE];
+    char *prefix, *name, *end;
+    sysalloc_t *s;
+    void *lib;
+
+    strncpy(path, spec, MAXLINE - 1);
+    path[MAXLINE - 1] = '\0';
+    if ((prefix = strchr(path, ':')) != NULL)
+	*prefix++ = '\0';
+    else
+	prefix = "";
+    if ((lib = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+	printf("Warning: skipping %s: %s\n", path, dlerror());
+	return NULL;
+    }
+    if ((s = (sysalloc_t *)calloc(1, sizeof(sysalloc_t))) == NULL)
+	unix_error("calloc failed in load_sysalloc");
+
+    sprintf(sym, "%smalloc", prefix);
+    s->malloc = dlsym(lib, sym);
+    sprintf(sym, "%sfree", prefix);
+    s->free = dlsym(lib, sym);
+    sprintf(sym, "%srealloc", prefix);
+    s->realloc = dlsym(lib, sym);
+    sprintf(sym, "%sposix_memalign", prefix);
+    s->posix_memalign = dlsym(lib, sym);
+
+    /* A library without a malloc of its own finds the one of libc */
+    if (s->malloc == NULL || s->free == NULL || s->realloc == NULL ||
+	s->posix_memalign == NULL || s->malloc == malloc) {
+	printf("Warning: skipping %s: it has no %smalloc, %sfree, %srealloc "
+	       "and %sposix_memalign of its own\n", path, prefix, prefix,
+	       prefix, prefix);
+	free(s);
+	dlclose(lib);
+	return NULL;
+    }
+
+    /* The package is named like the library, without lib and .so */
+    name = (name = strrchr(path, '/')) != NULL ? name + 1 : path;
+    if (strncmp(name, "lib", 3) == 0 && name[3] != '\0')
+	name += 3;
+    if ((s->name = strdup(name)) == NULL)
+	unix_error("strdup failed in load_sysalloc");
+    if ((end = strchr(s->name, '.')) != NULL)
+	*end = '\0';
+    return s;
+}
+
+/*****************************************************************
+ * The following routines keep the results of a run in a file (-o)
+ * and compare a later run with such a baseline (-C). Each line holds
+ * one package on one trace, or on the total of the traces:
+ *
+ *   package trace valid ops util Kops ci runs samples
+ *
+ * separated by tabs, where ci is the half width of the 95% confidence
+ * interval of the throughput, util is "-" for outside packages and
+ * samples is the throughput of each timed run, separated by commas.
+ *
+ * The files of several runs of mdriver can be put together into one,
+ * whose lines of the same package and trace are pooled when it is
+ * read. The mean throughput of each run of mdriver is then a sample
+ * of its own, rather than its timed runs, since they vary a lot less
+ * than the processes do: a process can be 30% faster than the others
+ * from the start.
+ ****************************************************************/
+
+/*
+ * bench_result - Sum up the results of a package on trace tracenum, or
+ *     on all n traces if it is -1. The throughput of the r-th timed run
+ *     of all traces is their requests over the r-th runs of each.
+ */
+static void bench_result(stats_t *stats, int n, int tracenum, int outside,
+			 bench_t *result)
+{
+    int lo = (tracenum < 0) ? 0 : tracenum;
+    int hi = (tracenum < 0) ? n : tracenum + 1;
+    double secs;
+    int i, r;
+
+    result->valid = 1;
+    result->ops = result->util = 0;
+    result->runs = MAX_RUNS;
+    for (i = lo; i < hi; i++) {
+	result->valid &= stats[i].valid;
+	result->ops += stats[i].ops;
+	result->util += stats[i].util;
+	result->runs = (stats[i].runs < result->runs) ? stats[i].runs : result->runs;
+    }
+    result->util = outside ? -1 : result->util / (hi - lo);
+    if (!result->valid || result->runs == 0) {
+	result->valid = 0;
+	result->runs = 0;
+    }
+
+    for (r = 0; r < result->runs; r++) {
+	for (secs = 0, i = lo; i < hi; i++)
+	    secs += stats[i].run_secs[r];
+	result->run_kops[r] = (result->ops / 1e3) / secs;
+    }
+    bench_stats(result);
+}
+
+/*
+ * bench_stats - Compute the mean throughput of the timed runs of a
+ *     result, its standard deviation and its confidence interval
+ */
+static void bench_stats(bench_t *result)
+{
+    double var = 0;
+    int r;
+
+    result->kops = result->sd = result->ci = 0;
+    if (result->runs == 0)
+	return;
+    for (r = 0; r < result->runs; r++)
+	result->kops += result->run_kops[r];
+    result->kops /= result->runs;
+    if (result->runs > 1) {
+	for (r = 0; r < result->runs; r++)
+	    var += (result->run_kops[r] - result->kops) *
+		(result->run_kops[r] - result->kops);
+	result->sd = sqrt(var / (result->runs - 1));
+	result->ci = t95(result->runs - 1) * result->sd / sqrt(result->runs);
+    }
+}
+
+/*
+ * t95 - The two-sided 95% quantile of Student's t distribution with df
+ *     degrees of freedom. Beyond the table the last entry is used,
+ *     which is a bit too big and so errs on the safe side.
+ */
+static double t95(int df)
+{
+    static double t[] = {
+	12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+	2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+	2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+    };
+    int max = sizeof(t) / sizeof(double);
+
+    if (df < 1)
+	df = 1;
+    return t[(df < max ? df : max) - 1];
+}
+
+/*
+ * slower - Welch's t test on the samples: returns 1 if the mean
+ *     throughput of result is below the baseline's at the 2.5% level
+ *     (one sided), without assuming the two have the same variance.
+ *     Either needs two runs at least, or nothing is known.
+ */
+static int slower(bench_t *base, bench_t *result)
+{
+    double vb, vr, t, df;
+
+    if (base->runs < 2 || result->runs < 2)
+	return 0;
+    vb = base->sd * base->sd / base->runs;
+    vr = result->sd * result->sd / result->runs;
+    if (vb + vr == 0)
+	return result->kops < base->kops;
+
+    /* With the degrees of freedom of Welch-Satterthwaite, rounded down */
+    t = (base->kops - result->kops) / sqrt(vb + vr);
+    df = (vb + vr) * (vb + vr) /
+	(vb * vb / (base->runs - 1) + vr * vr / (result->runs - 1));
+    return t > t95((int)df);
+}
+
+/*
+ * suite_results - Sum up the results of every package on each trace
+ *     and on all of them, returns the number of lines
+ */
+static int suite_results(suite_t *suite, bench_line_t **lines)
+{
+    int n = suite->num_tracefiles;
+    int np = suite->num_sysallocs + suite->num_backends;
+    bench_line_t *line;
+    stats_t *stats;
+    int i, p;
+
+    if ((*lines = calloc(np * (n + 1), sizeof(bench_line_t))) == NULL)
+	unix_error("ERROR: calloc failed in suite_results");
+    for (p = 0; p < np; p++) {
+	for (i = 0; i <= n; i++) {
+	    line = &(*lines)[p * (n + 1) + i];
+	    strcpy(line->name, package(suite, p, &stats));
+	    strcpy(line->trace, i < n ? suite->tracefiles[i] : "total");
+	    bench_result(stats, n, i < n ? i : -1, p < suite->num_sysallocs,
+			 &line->result);
+	}
+    }
+    return np * (n + 1);
+}
+
+/*
+ * read_results - Read a results file, pooling the lines of the same
+ *     package and trace, returns the number of lines
+ */
+static int read_results(char *file, bench_line_t **lines)
+{
+    char buf[MAXLINE], name[MAXLINE], trace[MAXLINE], util[MAXLINE];
+    char samples[MAXLINE], *p, *end;
+    int num_lines = 0, i, valid, runs;
+    bench_line_t *line;
+    double ops, kops, ci;
+    FILE *fp;
+
+    if ((fp = fopen(file, "r")) == NULL)
+	unix_error("ERROR: can't open the results file");
+    *lines = NULL;
+    while (fgets(buf, MAXLINE, fp) != NULL) {
+	if (buf[0] == '#' ||
+	    sscanf(buf, "%s %s %d %lf %s %lf %lf %d %s", name, trace, &valid,
+		   &ops, util, &kops, &ci, &runs, samples) != 9)
+	    continue;
+	for (i = 0; i < num_lines; i++)
+	    if (!strcmp((*lines)[i].name, name) &&
+		!strcmp((*lines)[i].trace, trace))
+		break;
+	if (i == num_lines) {
+	    if ((*lines = realloc(*lines, (num_lines + 1) * sizeof(bench_line_t))) == NULL)
+		unix_error("ERROR: realloc failed in read_results");
+	    line = &(*lines)[num_lines++];
+	    strcpy(line->name, name);
+	    strcpy(line->trace, trace);
+	    line->result.valid = valid;
+	    line->result.ops = ops;
+	    line->result.util = strcmp(util, "-") ? atof(util) : -1;
+	    line->result.runs = line->procs = 0;
+	    for (p = samples; *p != '\0' && line->result.runs < MAX_RUNS; p = end) {
+		line->result.run_kops[line->result.runs] = strtod(p, &end);
+		if (end == p)
+		    break;
+		line->result.runs++;
+		end += (*end == ',');
+	    }
+	}
+	line = &(*lines)[i];
+
+	/* The total of another set of traces (or a changed trace) doesn't pool */
+	if (line->result.ops != ops || line->procs == MAX_SAMPLES)
+	    continue;
+	line->result.valid &= valid;
+	if (runs > 0)
+	    line->proc_kops[line->procs++] = kops;
+    }
+    fclose(fp);
+
+    /* The runs of mdriver are the samples, if there are several */
+    for (i = 0; i < num_lines; i++) {
+	line = &(*lines)[i];
+	if (line->procs > 1) {
+	    memcpy(line->result.run_kops, line->proc_kops,
+		   line->procs * sizeof(double));
+	    line->result.runs = line->procs;
+	}
+	bench_stats(&line->result);
+    }
+    return num_lines;
+}
+
+/*
+ * write_results - Write the results of every package to a file
+ */
+static void write_results(char *file, bench_line_t *lines, int num_lines)
+{
+    bench_t *result;
+    FILE *fp;
+    int i, r;
+
+    if ((fp = fopen(file, "w")) == NULL)
+	unix_error("ERROR: can't open the results file");
+    fprintf(fp, "# package\ttrace\tvalid\tops\tutil\tKops\tci\truns\tsamples\n");
+    for (i = 0; i < num_lines; i++) {
+	result = &lines[i].result;
+	fprintf(fp, "%s\t%s\t%d\t%.0f\t", lines[i].name, lines[i].trace,
+		result->valid, result->ops);
+	if (result->util < 0)
+	    fprintf(fp, "-");
+	else
+	    fprintf(fp, "%.4f", result->util);
+	fprintf(fp, "\t%.1f\t%.1f\t%d\t", result->kops, result->ci,
+		result->runs);
+	for (r = 0; r < result->runs; r++)
+	    fprintf(fp, "%s%.1f", r ? "," : "", result->run_kops[r]);
+	fprintf(fp, "%s\n", result->runs ? "" : "-");
+    }
+    fclose(fp);
+}
+
+/*
+ * compare_results - Compare the results with the baseline in a file,
+ *     for each package and trace the two have in common, and print the
+ *     regressions: a result that isn't correct anymore, whose util falls
+ *     more than threshold behind, or whose throughput does and is lower
+ *     by Welch's t test as well. The threshold is the smallest effect
+ *     worth reporting, the test keeps noise from being reported. With a
+ *     test per trace and package some would be lower by chance alone,
+ *     so only the throughput on the total of the traces is a regression
+ *     and the traces are just printed. Returns the number of regressions.
+ */
+static int compare_results(char *file, bench_line_t *lines, int num_lines,
+			   double threshold)
+{
+    int compared = 0, regressions = 0;
+    bench_line_t *base_lines;
+    bench_t *base, *result;
+    int num_base, b, i, total;
+    char *name, *trace;
+
+    num_base = read_results(file, &base_lines);
+    for (b = 0; b < num_base; b++) {
+	name = base_lines[b].name;
+	trace = base_lines[b].trace;
+	base = &base_lines[b].result;
+	for (i = 0; i < num_lines; i++)
+	    if (!strcmp(lines[i].name, name) && !strcmp(lines[i].trace, trace))
+		break;
+	if (i == num_lines)
+	    continue;
+	result = &lines[i].result;
+
+	/* The total of another set of traces (or a changed trace) doesn't compare */
+	if (result->ops != base->ops)
+	    continue;
+	compared++;
+
+	if (base->valid && !result->valid) {
+	    printf("REGRESSION %s on %s: not correct anymore\n", name, trace);
+	    regressions++;
+	    continue;
+	}
+	if (!base->valid || !result->valid)
+	    continue;
+	if (base->util >= 0 && result->util < base->util * (1 - threshold)) {
+	    printf("REGRESSION %s on %s: util %.1f%%, baseline %.1f%%\n",
+		   name, trace, result->util * 100, base->util * 100);
+	    regressions++;
+	}
+	if (result->kops < base->kops * (1 - threshold) && slower(base, result)) {
+	    total = !strcmp(trace, "total");
+	    printf("%s %s on %s: %.0f +-%.0f Kops, baseline %.0f +-%.0f (%+.1f%%)\n",
+		   total ? "REGRESSION" : "Slower", name, trace, result->kops,
+		   result->ci, base->kops, base->ci,
+		   (result->kops / base->kops - 1) * 100);
+	    regressions += total;
+	}
+    }
+    free(base_lines);
+    printf("Compared %d results with %s: %d regression%s\n", compared, file,
+	   regressions, regressions == 1 ? "" : "s");
+    return regressions;
+}
+
+/*
+ * package - Return the name and the stats of package p, where the
+ *     outside packages come before the mm ones
+ */
+static char *package(suite_t *suite, int p, stats_t **stats)
+{
+    if (p < suite->num_sysallocs) {
+	*stats = suite->sys_stats[p];
+	return suite->sysallocs[p]->name;
+    }
+    p -= suite->num_sysallocs;
+    *stats = suite->mm_stats[p];
+    return suite->backends[p]->name;
+}
+
 /*************************************
  * Some miscellaneous helper routines
  ************************************/
 
+/*
+ * parse_cpulist - Add the CPUs of a list of ranges like "0-3,8-11" to
+ *     set, returns how many the list names
+ */
+static int parse_cpulist(char *list, cpu_set_t *set)
+{
+    char *p, *end;
+    int lo, hi, cpu, n = 0;
+
+    for (p = list; *p >= '0' && *p <= '9'; p = end + (*end == ',')) {
+	lo = hi = (int)strtol(p, &end, 10);
+	if (*end == '-')
+	    hi = (int)strtol(end + 1, &end, 10);
+	for (cpu = lo; cpu <= hi && cpu < CPU_SETSIZE; cpu++, n++)
+	    CPU_SET(cpu, set);
+    }
+    return n;
+}
+
+/*
+ * pin_cpu - Pin the calling process to the n-th CPU of -k, round robin
+ */
+static void pin_cpu(int n)
+{
+    cpu_set_t set;
+    int cpu;
+
+    n %= CPU_COUNT(&pin_cpus);
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	if (CPU_ISSET(cpu, &pin_cpus) && n-- == 0)
+	    break;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0)
+	unix_error("sched_setaffinity failed in pin_cpu");
+}
+
+/*
+ * samples_open - Start the file of the -s samples, a JSON array if its
+ *     name ends in .json, else CSV with a header line
+ */
+static void samples_open(char *file)
+{
+    int c;
+
+    sample_fp = stdout;
+    if (file != NULL && (sample_fp = fopen(file, "w")) == NULL)
+	unix_error("ERROR: can't open the sample file");
+    sample_json = (file != NULL && strlen(file) > 5 &&
+		   strcmp(file + strlen(file) - 5, ".json") == 0);
+
+    if (sample_json) {
+	fprintf(sample_fp, "[");
+	return;
+    }
+    fprintf(sample_fp, "package,trace,op,live_bytes,heap_bytes,mapped_bytes,"
+	    "resident_bytes,free_bytes,free_blocks,largest_free,ext_frag,slot_bytes,"
+	    "cached_bytes,cycles_per_op");
+    for (c = 0; c < HEAPSTATS_CLASSES; c++)
+	fprintf(sample_fp, ",free_%lu", 16UL << c);
+    fprintf(sample_fp, "\n");
+}
+
+/*
+ * sample_heap - Write one sample of the layout of the current backend's
+ *     heap, after opnum requests of a trace with live payload bytes, and
+ *     the bytes of the heap in memory. The external fragmentation is
+ *     1 - largest free block / free bytes. A package without
+ *     mm_heapstats only gets the driver's numbers.
+ */
+static void sample_heap(int tracenum, int opnum, int live, double cycles)
+{
+    size_t resident = mem_resident();
+    heapstats_t hs;
+    double frag;
+    int c;
+
+    memset(&hs, 0, sizeof(hs));
+    if (backend->heapstats != NULL)
+	backend->heapstats(&hs);
+    else
+	hs.heap_bytes = mem_heapsize();
+    frag = hs.free_bytes ? 1.0 - (double)hs.largest_free/hs.free_bytes : 0;
+
+    if (sample_json) {
+	fprintf(sample_fp, "%s\n {\"package\": \"%s\", \"trace\": %d, \"op\": %d, "
+		"\"live_bytes\": %d, \"heap_bytes\": %zu, \"mapped_bytes\": %zu, "
+		"\"resident_bytes\": %zu, \"free_bytes\": %zu, \"free_blocks\": %zu, "
+		"\"largest_free\": %zu, \"ext_frag\": %.4f, \"slot_bytes\": %zu, "
+		"\"cached_bytes\": %zu, \"cycles_per_op\": %.1f, \"free_hist\": [",
+		num_samples ? "," : "", backend->name, tracenum, opnum, live,
+		hs.heap_bytes, mem_mapsize(), resident, hs.free_bytes,
+		hs.free_blocks, hs.largest_free, frag, hs.slot_bytes,
+		hs.cached_bytes, cycles);
+	for (c = 0; c < HEAPSTATS_CLASSES; c++)
+	    fprintf(sample_fp, "%s%zu", c ? ", " : "", hs.free_hist[c]);
+	fprintf(sample_fp, "]}");
+    }
+    else {
+	fprintf(sample_fp, "%s,%d,%d,%d,%zu,%zu,%zu,%zu,%zu,%zu,%.4f,%zu,%zu,%.1f",
+		backend->name, tracenum, opnum, live, hs.heap_bytes, 
+		mem_mapsize(), resident, hs.free_bytes, hs.free_blocks,
+		hs.largest_free, frag, hs.slot_bytes, hs.cached_bytes, cycles);
+	for (c = 0; c < HEAPSTATS_CLASSES; c++)
+	    fprintf(sample_fp, ",%zu", hs.free_hist[c]);
+	fprintf(sample_fp, "\n");
+    }
+    num_samples++;
+}
+
+/*
+ * samples_close - Finish the sample file
+ */
+static void samples_close(void)
+{
+    if (sample_json)
+	fprintf(sample_fp, "\n]\n");
+    if (sample_fp != stdout)
+	fclose(sample_fp);
+    else
+	fflush(sample_fp);
+}
+
 
 /*
  * printresults - prints a performance summary for some malloc package
  */
 static void printresults(int n, stats_t *stats) 
 {
-    int i;
+    int i, e;
     double secs = 0;
     double ops = 0;
     double util = 0;
+    int events = 0;                    /* were events counted (-e)? */
+    int touched = 0;                   /* were payloads touched (-T, -R)? */
+    double touch_secs = 0;
+    int huge = 0;                      /* was there a huge page pass (-L, -P)? */
+    double huge_secs = 0;
+    double counts[PERF_NUM_EVENTS];    /* events of all traces */
+    double counted[PERF_NUM_EVENTS];   /* ops of the traces they are for */
+
+    for (i=0; i < n; i++) {
+	events |= stats[i].events != NULL;
+	touched |= stats[i].touch_secs > 0;
+	huge |= stats[i].huge_secs > 0;
+    }
+    for (e = 0; e < PERF_NUM_EVENTS; e++)
+	counts[e] = counted[e] = 0;
 
     /* Print the individual results for each trace */
-    printf("%5s%7s %5s%8s%10s%6s\n", 
+    printf("%5s%7s %5s%8s%10s%6s", 
 	   "trace", " valid", "util", "ops", "secs", "Kops");
+    if (touched)
+	printf("%8s", "tchKops");
+    if (huge)
+	printf("%8s", "thpKops");
+    if (events) {
+	printf("  per op:");
+	for (e = 0; e < PERF_NUM_EVENTS; e++)
+	    printf("%8s", perf_event_names[e]);
+    }
+    printf("\n");
     for (i=0; i < n; i++) {
 	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f", 
 		   i,
 		   "yes",
 		   stats[i].util*100.0,
@@ -948,6 +2942,25 @@ static void printresults(int n, stats_t *stats)
 	    secs += stats[i].secs;
 	    ops += stats[i].ops;
 	    util += stats[i].util;
+	    if (touched) {
+		printf("%8.0f", (stats[i].ops/1e3)/stats[i].touch_secs);
+		touch_secs += stats[i].touch_secs;
+	    }
+	    if (huge) {
+		printf("%8.0f", (stats[i].ops/1e3)/stats[i].huge_secs);
+		huge_secs += stats[i].huge_secs;
+	    }
+	    if (events) {
+		printf("%9s", "");
+		for (e = 0; e < PERF_NUM_EVENTS; e++)
+		    printevent(stats[i].events ? stats[i].events[e] : -1);
+		for (e = 0; stats[i].events && e < PERF_NUM_EVENTS; e++)
+		    if (stats[i].events[e] >= 0) {
+			counts[e] += stats[i].events[e]*stats[i].ops;
+			counted[e] += stats[i].ops;
+		    }
+	    }
+	    printf("\n");
 	}
 	else {
 	    printf("%2d%10s%6s%8s%10s%6s\n", 
@@ -962,12 +2975,22 @@ static void printresults(int n, stats_t *stats)
 
     /* Print the aggregate results for the set of traces */
     if (errors == 0) {
-	printf("%12s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	printf("%12s%5.0f%%%8.0f%10.6f%6.0f", 
 	       "Total       ",
 	       (util/n)*100.0,
 	       ops, 
 	       secs,
 	       (ops/1e3)/secs);
+	if (touched)
+	    printf("%8.0f", (ops/1e3)/touch_secs);
+	if (huge)
+	    printf("%8.0f", (ops/1e3)/huge_secs);
+	if (events) {
+	    printf("%9s", "");
+	    for (e = 0; e < PERF_NUM_EVENTS; e++)
+		printevent(counted[e] > 0 ? counts[e]/counted[e] : -1);
+	}
+	printf("\n");
     }
     else {
 	printf("%12s%6s%8s%10s%6s\n", 
@@ -980,6 +3003,244 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printevent - prints one per op event count of the results table, 
+ *    "-" if it couldn't be counted
+ */
+static void printevent(double count)
+{
+    if (count < 0)
+	printf("%8s", "-");
+    else if (count < 10)
+	printf("%8.3f", count);
+    else
+	printf("%8.1f", count);
+}
+
+/*
+ * printcompare - prints the util and throughput of several malloc
+ * packages on each trace next to each other, the last line gives the
+ * throughput of each package relative to the first one
+ */
+static void printcompare(int n, int nb, backend_t **backends, stats_t **stats)
+{
+    int i, b;
+    double secs, ops, util, first = 0;
+
+    printf("%5s", "trace");
+    for (b = 0; b < nb; b++)
+	printf("%13.12s", backends[b]->name);
+    printf("\n%5s", "");
+    for (b = 0; b < nb; b++)
+	printf("%6s%7s", "util", "Kops");
+    printf("\n");
+
+    for (i = 0; i < n; i++) {
+	printf("%2d   ", i);
+	for (b = 0; b < nb; b++) {
+	    if (stats[b][i].valid)
+		printf("%5.0f%%%7.0f", stats[b][i].util*100.0,
+		       (stats[b][i].ops/1e3)/stats[b][i].secs);
+	    else
+		printf("%6s%7s", "-", "-");
+	}
+	printf("\n");
+    }
+
+    printf("%5s", "Total");
+    for (b = 0; b < nb; b++) {
+	secs = ops = util = 0;
+	for (i = 0; i < n; i++) {
+	    if (stats[b][i].valid) {
+		secs += stats[b][i].secs;
+		ops += stats[b][i].ops;
+		util += stats[b][i].util;
+	    }
+	}
+	printf("%5.0f%%%7.0f", (util/n)*100.0, secs > 0 ? (ops/1e3)/secs : 0);
+    }
+    printf("\n%5s", "Speed");
+    for (b = 0; b < nb; b++) {
+	secs = ops = 0;
+	for (i = 0; i < n; i++) {
+	    if (stats[b][i].valid) {
+		secs += stats[b][i].secs;
+		ops += stats[b][i].ops;
+	    }
+	}
+	if (b == 0)
+	    first = secs > 0 ? ops/secs : 0;
+	if (secs > 0 && first > 0)
+	    printf("%12.2fx", (ops/secs)/first);
+	else
+	    printf("%13s", "-");
+    }
+    printf("\n");
+}
+
+/*
+ * printbench - prints the mean throughput of the timed runs of every
+ * package on each trace, with the half width of its 95% confidence
+ * interval
+ */
+static void printbench(suite_t *suite)
+{
+    int n = suite->num_tracefiles;
+    int np = suite->num_sysallocs + suite->num_backends;
+    stats_t *stats;
+    bench_t result;
+    int i, p;
+
+    printf("%5s", "trace");
+    for (p = 0; p < np; p++)
+	printf("%16.15s", package(suite, p, &stats));
+    printf("\n");
+
+    /* The traces, then the total of all of them */
+    for (i = 0; i <= n; i++) {
+	if (i < n)
+	    printf("%2d   ", i);
+	else
+	    printf("%5s", "Total");
+	for (p = 0; p < np; p++) {
+	    package(suite, p, &stats);
+	    bench_result(stats, n, i < n ? i : -1, p < suite->num_sysallocs,
+			 &result);
+	    if (result.valid)
+		printf("%9.0f +-%4.0f", result.kops, result.ci);
+	    else
+		printf("%16s", "-");
+	}
+	printf("\n");
+    }
+}
+
+/*
+ * printperfindex - computes and prints the performance index of a
+ * malloc package, which is 0 if it had any errors
+ */
+static double printperfindex(int n, stats_t *stats, int errs, int *numcorrect)
+{
+    int i;
+    double secs = 0, ops = 0, util = 0;
+    double avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
+
+    *numcorrect = 0;
+    for (i=0; i < n; i++) {
+	secs += stats[i].secs;
+	ops += stats[i].ops;
+	util += stats[i].util;
+	if (stats[i].valid)
+	    (*numcorrect)++;
+    }
+    avg_mm_util = util/n;
+
+    if (errs == 0) {
+	avg_mm_throughput = ops/secs;
+
+	p1 = UTIL_WEIGHT * avg_mm_util;
+	if (avg_mm_throughput > AVG_LIBC_THRUPUT) {
+	    p2 = (double)(1.0 - UTIL_WEIGHT);
+	} 
+	else {
+	    p2 = ((double) (1.0 - UTIL_WEIGHT)) * 
+		(avg_mm_throughput/AVG_LIBC_THRUPUT);
+	}
+	
+	perfindex = (p1 + p2)*100.0;
+	printf("Perf index = %.0f (util) + %.0f (thru) = %.0f/100\n",
+	       p1*100, 
+	       p2*100, 
+	       perfindex);
+    }
+    else { /* There were errors */
+	perfindex = 0.0;
+	printf("Terminated with %d errors\n", errs);
+    }
+    return perfindex;
+}
+
+/*
+ * parse_backends - look up the comma separated malloc package names
+ * of -b in the registry, returns how many there are
+ */
+static int parse_backends(char *names, backend_t **backends)
+{
+    char *name;
+    backend_t *b;
+    int n = 0;
+
+    for (name = strtok(names, ","); name != NULL; name = strtok(NULL, ",")) {
+	if ((b = backend_find(name)) == NULL) {
+	    fprintf(stderr, "ERROR: unknown malloc package %s, there are:", name);
+	    for (b = backend_list(); b != NULL; b = b->next)
+		fprintf(stderr, " %s", b->name);
+	    fprintf(stderr, "\n");
+	    exit(1);
+	}
+	if (n == MAX_BACKENDS) {
+	    fprintf(stderr, "ERROR: -b takes at most %d packages\n", MAX_BACKENDS);
+	    exit(1);
+	}
+	backends[n++] = b;
+    }
+    return n;
+}
+
+/*
+ * printlatencies - prints the latency percentiles of each request
+ *    type on each trace, from the histograms recorded with -H
+ */
+static void printlatencies(int n, stats_t *stats)
+{
+    int i, t;
+    hist_t *h;
+    static char *names[NUM_OPTYPES] = {"malloc", "free", "realloc",
+				       "malloc_b", "free_b", "memalign"};
+
+    printf("%5s%9s%9s%8s%8s%8s%10s\n",
+	   "trace", "op", "count", "p50", "p99", "p99.9", "max");
+    for (i=0; i < n; i++) {
+	if (stats[i].latency == NULL)
+	    continue;
+	for (t = 0; t < NUM_OPTYPES; t++) {
+	    h = &stats[i].latency[t];
+	    if (h->total == 0)
+		continue;
+	    printf("%2d%12s%9llu%8llu%8llu%8llu%10llu\n",
+		   i,
+		   names[t],
+		   h->total,
+		   hist_percentile(h, 0.5),
+		   hist_percentile(h, 0.99),
+		   hist_percentile(h, 0.999),
+		   h->max);
+	}
+    }
+}
+
+/*
+ * printresident - prints how much of the heap was in memory during 
+ *    each trace, next to the peak heap size that util is based on
+ */
+static void printresident(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%10s%10s%10s%10s\n",
+	   "trace", "peak", "max rss", "avg rss", "end rss");
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid)
+	    continue;
+	printf("%2d%13.0f%10.0f%10.0f%10.0f\n",
+	       i,
+	       stats[i].heap_peak/1024,
+	       stats[i].resident_max/1024,
+	       stats[i].resident_avg/1024,
+	       stats[i].resident_end/1024);
+    }
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -1012,14 +3273,39 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvVacelLpPRHz] [-b <names>] [-f <file>] [-t <dir>]\n"
+	    "               [-j <n>] [-k <cpus>] [-s <n>] [-S <file>] [-T <percent>]\n"
+	    "               [-w <n>] [-D <lib>] [-r <n>] [-o <file>] [-C <file>] [-I <file>]\n"
+	    "               [-x <pct>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-b <names> Compare the comma separated malloc packages.\n");
+    fprintf(stderr, "\t-c         Check the heap after every request.\n");
+    fprintf(stderr, "\t-C <file>  Compare the results with a baseline, exit with 2 on regressions.\n");
+    fprintf(stderr, "\t-D <lib>   Run the malloc of a shared library too, lib[:prefix].\n");
+    fprintf(stderr, "\t-e         Count hardware events per request (with -v).\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H         Print per-request latency percentiles.\n");
+    fprintf(stderr, "\t-I <file>  Compare the results in <file> with -C instead of running.\n");
+    fprintf(stderr, "\t-j <n>     Replay each trace on 1..n threads (mdriver-mt only).\n");
+    fprintf(stderr, "\t-k <cpus>  Pin the timed runs to a CPU of the list, like 2-5,8.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L         Also time replays on a huge page heap.\n");
+    fprintf(stderr, "\t-o <file>  Write the results to <file>, a baseline for -C.\n");
+    fprintf(stderr, "\t-p         Spread the -j threads over the NUMA nodes, count remote blocks.\n");
+    fprintf(stderr, "\t-P         Same as -L, with the heap faulted in up front.\n");
+    fprintf(stderr, "\t-r <n>     Time each package n times, for confidence intervals.\n");
+    fprintf(stderr, "\t-R         Also time replays that read payloads back before free.\n");
+    fprintf(stderr, "\t-s <n>     Sample the heap layout every n requests.\n");
+    fprintf(stderr, "\t-S <file>  Write the samples to <file>, JSON if it ends in .json.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <pct>   Also time replays that write pct%% of each payload.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t-w <n>     Evaluate the traces in n worker processes.\n");
+    fprintf(stderr, "\t-x <pct>   Results may fall pct%% behind the baseline (default %d).\n",
+	    REGRESSION);
+    fprintf(stderr, "\t-z         Pass the block sizes to free and realloc.\n");
 }
@@ -2,7 +2,30 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ *            The memory is modeled as a set of arenas, each one a heap with
+ *            its own brk pointer, so independent heaps can grow at the same
+ *            time. The classic mem_xxx functions work on the default arena
+ *            that mem_init creates.
+ *
+ *            Next to the arenas there are mapped regions, the model of 
+ *            mmap, for blocks that an allocator does not want in its heap.
+ *            They count towards the footprint of the default arena and are
+ *            all unmapped when it is reset.
+ *
+ *            An arena created with MEM_HUGE_PAGES is HUGE_PAGE aligned and
+ *            advised to be backed by transparent huge pages, which cuts the
+ *            TLB misses of a big heap. Pages are only given back to the OS
+ *            a whole huge page at a time then, releasing part of one would
+ *            split it.
+ *
+ *            mem_node_arena hands out one arena per NUMA node, the default
+ *            arena for node 0. On a machine with several nodes each one is
+ *            bound to its node with mbind, so its pages come from the
+ *            memory of that node. The footprint and the resident bytes of
+ *            the model are those of all arenas together.
  */
+#define _GNU_SOURCE     /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -10,28 +33,85 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/syscall.h>
 
 #include "memlib.h"
 #include "config.h"
 
+/* One simulated heap */
+struct mem_arena {
+    char *start_brk;  /* points to first byte of heap */
+    char *brk;        /* points to last byte of heap */
+    char *peak_brk;   /* highest brk since the last reset */
+    char *max_addr;   /* largest legal heap address */ 
+    size_t pagesize;  /* size of the pages backing the arena */
+    int claimed;      /* set while a mem_arena_create owns the slot */
+    int ready;        /* set once the arena may be used */
+};
+
+/* Size and alignment of a transparent huge page, x86-64 and aarch64 with 4K pages */
+#define HUGE_PAGE (1UL << 21)
+
+/* The mbind policy that prefers the pages of one node, from <numaif.h> */
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+/* Where the kernel lists the NUMA nodes that are online */
+#define NODE_LIST "/sys/devices/system/node/online"
+
+/* Round p down or up to a page boundary */
+#define PAGE_DOWN(p) ((char *)((size_t)(p) & ~(mem_pagesize() - 1)))
+#define PAGE_UP(p)   PAGE_DOWN((char *)(p) + mem_pagesize() - 1)
+
+/* One mapped region */
+typedef struct mem_map {
+    char *lo;             /* first byte of the region */
+    size_t size;          /* length of the region, a multiple of the page size */
+    struct mem_map *next; /* next region in the list */
+} mem_map_t;
+
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static mem_arena_t arenas[MAX_ARENAS]; /* arenas[0] is the default arena */
+static int num_arenas;                 /* slots below this may have been handed out */
+static mem_map_t *maps;                /* the mapped regions */
+static size_t map_bytes;               /* their total size */
+static size_t peak_footprint;          /* highest size of all arenas + map_bytes since the last reset */
+static int default_flags;              /* MEM_xxx flags of the default arena, the node arenas get them too */
+static mem_arena_t *node_arenas[MAX_ARENAS]; /* the arena of each NUMA node, NULL until asked for */
+static int num_nodes;                  /* NUMA nodes of the machine, 0 until known */
+static char map_lock;                  /* guards the three above */
 
+static void map_lock_acquire(void);
+static void map_lock_release(void);
+static void update_footprint(void);
+static size_t arena_pagesize(void *p);
+static int claim_slot(void);
+static void arena_bind(mem_arena_t *arena, int node);
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
-	exit(1);
-    }
+    mem_init_flags(0);
+}
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
+/* 
+ * mem_init_flags - initialize the memory system model with a default 
+ *    arena backed as flags (MEM_HUGE_PAGES, MEM_POPULATE) say. Call 
+ *    mem_deinit first to switch a running model.
+ */
+void mem_init_flags(int flags)
+{
+    int i;
+
+    for (i = 0; i < MAX_ARENAS; i++)
+	arenas[i].claimed = arenas[i].ready = 0;
+    num_arenas = 0;
+    default_flags = flags;
+    memset(node_arenas, 0, sizeof(node_arenas));
+    if (mem_arena_create_flags(MAX_HEAP, flags) == NULL)
+	exit(1);
 }
 
 /* 
@@ -39,33 +119,41 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    int i;
+
+    mem_unmap_all();
+    for (i = 0; i < num_arenas; i++) {
+	if (arenas[i].ready)
+	    munmap(arenas[i].start_brk, arenas[i].max_addr - arenas[i].start_brk);
+	arenas[i].claimed = arenas[i].ready = 0;
+    }
+    num_arenas = 0;
+    memset(node_arenas, 0, sizeof(node_arenas));
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointers to make every arena
+ *    an empty heap
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    int i;
+
+    mem_unmap_all();
+    for (i = 0; i < num_arenas && i < MAX_ARENAS; i++)
+	if (arenas[i].ready)
+	    mem_arena_reset_brk(&arenas[i]);
+    peak_footprint = 0;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area. A
+ *    negative incr shrinks the heap and gives its pages back to the OS.
  */
 void *mem_sbrk(int incr) 
 {
-    char *old_brk = mem_brk;
-
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
-	errno = ENOMEM;
-	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
-	return (void *)-1;
-    }
-    mem_brk += incr;
-    return (void *)old_brk;
+    return mem_arena_sbrk(&arenas[0], incr);
 }
 
 /*
@@ -73,7 +161,7 @@ void *mem_sbrk(int incr)
  */
 void *mem_heap_lo()
 {
-    return (void *)mem_start_brk;
+    return mem_arena_lo(&arenas[0]);
 }
 
 /* 
@@ -81,7 +169,7 @@ void *mem_heap_lo()
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return mem_arena_hi(&arenas[0]);
 }
 
 /*
@@ -89,7 +177,194 @@ void *mem_heap_hi()
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return mem_arena_heapsize(&arenas[0]);
+}
+
+/*
+ * mem_peak_heapsize() - returns the largest size of the heap plus the 
+ *    mapped regions since the last reset
+ */
+size_t mem_peak_heapsize()
+{
+    return peak_footprint;
+}
+
+/*
+ * mem_resident() - returns the bytes of the arenas and the mapped regions 
+ *    that are in memory
+ */
+size_t mem_resident()
+{
+    size_t resident = 0;
+    size_t i, pages;
+    unsigned char *vec;
+    mem_map_t *m;
+    int a;
+
+    for (a = 0; a < num_arenas && a < MAX_ARENAS; a++)
+	if (arenas[a].ready)
+	    resident += mem_arena_resident(&arenas[a]);
+
+    map_lock_acquire();
+    for (m = maps; m != NULL; m = m->next) {
+	pages = m->size / mem_pagesize();
+	if ((vec = (unsigned char *)malloc(pages)) == NULL)
+	    break;
+	if (mincore(m->lo, m->size, vec) == 0) {
+	    for (i = 0; i < pages; i++)
+		if (vec[i] & 1)
+		    resident += mem_pagesize();
+	}
+	free(vec);
+    }
+    map_lock_release();
+    return resident;
+}
+
+/*
+ * mem_map - simple model of an anonymous mmap. Returns a new page 
+ *    aligned region of at least size bytes, or NULL if out of memory
+ */
+void *mem_map(size_t size)
+{
+    mem_map_t *m;
+
+    if ((m = (mem_map_t *)malloc(sizeof(mem_map_t))) == NULL)
+	return NULL;
+    m->size = (size_t)PAGE_UP(size);
+    m->lo = (char *)mmap(NULL, m->size, PROT_READ | PROT_WRITE, 
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m->lo == MAP_FAILED) {
+	free(m);
+	fprintf(stderr, "ERROR: mem_map failed. Ran out of memory...\n");
+	return NULL;
+    }
+
+    map_lock_acquire();
+    m->next = maps;
+    maps = m;
+    map_bytes += m->size;
+    update_footprint();
+    map_lock_release();
+    return m->lo;
+}
+
+/*
+ * mem_unmap - unmap a region returned by mem_map or mem_remap
+ */
+void mem_unmap(void *p)
+{
+    mem_map_t **mp, *m;
+
+    map_lock_acquire();
+    for (mp = &maps; (m = *mp) != NULL; mp = &m->next) {
+	if (m->lo == (char *)p) {
+	    *mp = m->next;
+	    map_bytes -= m->size;
+	    break;
+	}
+    }
+    map_lock_release();
+
+    if (m != NULL) {
+	munmap(m->lo, m->size);
+	free(m);
+    }
+}
+
+/*
+ * mem_remap - resize a mapped region to at least size bytes, moving it 
+ *    if it can't grow where it is. Returns the new start of the region, 
+ *    or NULL (and the region is left alone) if out of memory
+ */
+void *mem_remap(void *p, size_t size)
+{
+    mem_map_t *m;
+    char *lo;
+
+    map_lock_acquire();
+    for (m = maps; m != NULL && m->lo != (char *)p; m = m->next)
+	;
+    map_lock_release();
+    if (m == NULL)
+	return NULL;
+
+    size = (size_t)PAGE_UP(size);
+    lo = (char *)mremap(m->lo, m->size, size, MREMAP_MAYMOVE);
+    if (lo == MAP_FAILED) {
+	fprintf(stderr, "ERROR: mem_remap failed. Ran out of memory...\n");
+	return NULL;
+    }
+
+    map_lock_acquire();
+    m->lo = lo;
+    map_bytes += size - m->size;
+    m->size = size;
+    update_footprint();
+    map_lock_release();
+    return lo;
+}
+
+/*
+ * mem_unmap_all - unmap every mapped region
+ */
+void mem_unmap_all(void)
+{
+    mem_map_t *m;
+
+    map_lock_acquire();
+    while ((m = maps) != NULL) {
+	maps = m->next;
+	munmap(m->lo, m->size);
+	free(m);
+    }
+    map_bytes = 0;
+    map_lock_release();
+}
+
+/*
+ * mem_mapped - return true if [lo, lo+len) lies in a single mapped region
+ */
+int mem_mapped(void *lo, size_t len)
+{
+    mem_map_t *m;
+    int found = 0;
+
+    map_lock_acquire();
+    for (m = maps; m != NULL; m = m->next) {
+	if ((char *)lo >= m->lo && (char *)lo + len <= m->lo + m->size) {
+	    found = 1;
+	    break;
+	}
+    }
+    map_lock_release();
+    return found;
+}
+
+/*
+ * mem_mapsize - returns the total size of the mapped regions in bytes
+ */
+size_t mem_mapsize()
+{
+    return map_bytes;
+}
+
+/*
+ * mem_release - give the pages that lie completely within [lo, lo+len)
+ *    back to the OS. The range stays part of the heap and reads as zero
+ *    the next time it is touched. Returns the number of bytes released.
+ */
+size_t mem_release(void *lo, size_t len)
+{
+    size_t page = arena_pagesize(lo);
+    char *start = (char *)(((size_t)lo + page - 1) & ~(page - 1));
+    char *end = (char *)(((size_t)lo + len) & ~(page - 1));
+
+    if (end <= start)
+	return 0;
+    if (madvise(start, end - start, MADV_DONTNEED) < 0)
+	return 0;
+    return end - start;
 }
 
 /*
@@ -99,3 +374,373 @@ size_t mem_pagesize()
 {
     return (size_t)getpagesize();
 }
+
+/*
+ * mem_heap_pagesize() - returns the size of the pages backing the heap,
+ *    bigger than mem_pagesize() if it is on huge pages
+ */
+size_t mem_heap_pagesize()
+{
+    return arenas[0].pagesize;
+}
+
+/*
+ * mem_num_nodes() - returns the number of NUMA nodes of the machine, 1 
+ *    if it can't tell
+ */
+int mem_num_nodes()
+{
+    char line[256];
+    char *p;
+    FILE *fp;
+    int n = 1;
+
+    if (num_nodes > 0)
+	return num_nodes;
+
+    /* A list of ranges like "0-1,3", the highest node tells how many */
+    if ((fp = fopen(NODE_LIST, "r")) != NULL) {
+	if (fgets(line, sizeof(line), fp) != NULL) {
+	    for (p = line; *p != '\0'; p++)
+		if ((p == line || p[-1] == '-' || p[-1] == ',') && 
+		    *p >= '0' && *p <= '9' && atoi(p) + 1 > n)
+		    n = atoi(p) + 1;
+	}
+	fclose(fp);
+    }
+    num_nodes = n;
+    return n;
+}
+
+/*
+ * mem_default_arena - return the arena used by the mem_xxx functions
+ */
+mem_arena_t *mem_default_arena(void)
+{
+    return &arenas[0];
+}
+
+/*
+ * mem_arena_create - allocate the storage for a new arena of at most 
+ *    size bytes. Safe to call from several threads at once. Returns 
+ *    NULL if there are already MAX_ARENAS arenas or out of memory.
+ */
+mem_arena_t *mem_arena_create(size_t size)
+{
+    return mem_arena_create_flags(size, 0);
+}
+
+/*
+ * mem_arena_create_flags - mem_arena_create with the storage backed as
+ *    flags say. A huge page arena is mapped with one huge page to spare
+ *    and trimmed to an aligned start. It is faulted in only after the
+ *    advice, MAP_POPULATE would fault it in on small pages.
+ */
+mem_arena_t *mem_arena_create_flags(size_t size, int flags)
+{
+    int slot = claim_slot();
+    mem_arena_t *arena;
+
+    if (slot < 0) {
+	fprintf(stderr, "mem_arena_create: more than %d arenas\n", MAX_ARENAS);
+	return NULL;
+    }
+    arena = &arenas[slot];
+
+    /* 
+     * allocate the storage we will use to model the available VM, it 
+     * is page aligned so that pages can be given back to the OS
+     */
+    if (flags & MEM_HUGE_PAGES) {
+	char *lo, *p;
+
+	size = (size + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+	lo = (char *)mmap(NULL, size + HUGE_PAGE, PROT_READ | PROT_WRITE, 
+			  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (lo == MAP_FAILED) {
+	    fprintf(stderr, "mem_arena_create: mmap error\n");
+	    __atomic_store_n(&arena->claimed, 0, __ATOMIC_RELEASE);
+	    return NULL;
+	}
+	arena->start_brk = (char *)(((size_t)lo + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1));
+	if (arena->start_brk > lo)
+	    munmap(lo, arena->start_brk - lo);
+	if (arena->start_brk < lo + HUGE_PAGE)
+	    munmap(arena->start_brk + size, lo + HUGE_PAGE - arena->start_brk);
+#ifdef MADV_HUGEPAGE
+	if (madvise(arena->start_brk, size, MADV_HUGEPAGE) < 0)
+	    fprintf(stderr, "mem_arena_create: no transparent huge pages\n");
+#endif
+	arena->pagesize = HUGE_PAGE;
+	if (flags & MEM_POPULATE)
+	    for (p = arena->start_brk; p < arena->start_brk + size; p += mem_pagesize())
+		*(volatile char *)p = 0;
+    }
+    else {
+	size = (size_t)PAGE_UP(size);
+	arena->start_brk = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE, 
+					MAP_PRIVATE | MAP_ANONYMOUS |
+					((flags & MEM_POPULATE) ? MAP_POPULATE : 0),
+					-1, 0);
+	if (arena->start_brk == MAP_FAILED) {
+	    fprintf(stderr, "mem_arena_create: mmap error\n");
+	    __atomic_store_n(&arena->claimed, 0, __ATOMIC_RELEASE);
+	    return NULL;
+	}
+	arena->pagesize = mem_pagesize();
+    }
+
+    arena->max_addr = arena->start_brk + size;  /* max legal heap address */
+    arena->brk = arena->start_brk;              /* heap is empty initially */
+    arena->peak_brk = arena->brk;
+    __atomic_store_n(&arena->ready, 1, __ATOMIC_RELEASE);
+    return arena;
+}
+
+/*
+ * claim_slot - claim the first free arena slot, returns -1 if there is
+ *    none. A slot whose mmap failed is given back, so failures don't
+ *    use up the table; num_arenas only bounds the scans of the slots.
+ */
+static int claim_slot(void)
+{
+    int slot, n;
+
+    for (slot = 0; slot < MAX_ARENAS; slot++)
+	if (!arenas[slot].claimed &&
+	    __atomic_exchange_n(&arenas[slot].claimed, 1, __ATOMIC_ACQ_REL) == 0)
+	    break;
+    if (slot == MAX_ARENAS)
+	return -1;
+
+    n = __atomic_load_n(&num_arenas, __ATOMIC_ACQUIRE);
+    while (n < slot + 1 &&
+	   !__atomic_compare_exchange_n(&num_arenas, &n, slot + 1, 0,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	;
+    return slot;
+}
+
+/*
+ * mem_arena_reset_brk - reset the brk pointer of an arena to make it empty
+ */
+void mem_arena_reset_brk(mem_arena_t *arena)
+{
+    arena->brk = arena->start_brk;
+    arena->peak_brk = arena->brk;
+}
+
+/* 
+ * mem_arena_sbrk - mem_sbrk for one arena. Only the thread that owns 
+ *    the arena may extend it.
+ */
+void *mem_arena_sbrk(mem_arena_t *arena, int incr) 
+{
+    char *old_brk = arena->brk;
+
+    if (incr < 0) {
+	if (arena->brk + incr < arena->start_brk) {
+	    errno = EINVAL;
+	    fprintf(stderr, "ERROR: mem_sbrk failed. Shrunk below the heap start...\n");
+	    return (void *)-1;
+	}
+	map_lock_acquire();
+	arena->brk += incr;
+	map_lock_release();
+	mem_release(arena->brk, PAGE_UP(old_brk) - arena->brk);
+	return (void *)old_brk;
+    }
+
+    if ((arena->brk + incr) > arena->max_addr) {
+	errno = ENOMEM;
+	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+	return (void *)-1;
+    }
+    /* The footprint adds up the brks of all arenas, so they change under the map lock */
+    map_lock_acquire();
+    arena->brk += incr;
+    if (arena->brk > arena->peak_brk)
+	arena->peak_brk = arena->brk;
+    update_footprint();
+    map_lock_release();
+    return (void *)old_brk;
+}
+
+/*
+ * mem_arena_lo - return address of the first byte of an arena
+ */
+void *mem_arena_lo(mem_arena_t *arena)
+{
+    return (void *)arena->start_brk;
+}
+
+/* 
+ * mem_arena_hi - return address of the last byte of an arena
+ */
+void *mem_arena_hi(mem_arena_t *arena)
+{
+    return (void *)(arena->brk - 1);
+}
+
+/*
+ * mem_arena_heapsize - returns the size of an arena in bytes
+ */
+size_t mem_arena_heapsize(mem_arena_t *arena)
+{
+    return (size_t)(arena->brk - arena->start_brk);
+}
+
+/*
+ * mem_arena_peak_heapsize - returns the largest size of an arena since
+ *    its last reset
+ */
+size_t mem_arena_peak_heapsize(mem_arena_t *arena)
+{
+    return (size_t)(arena->peak_brk - arena->start_brk);
+}
+
+/*
+ * mem_arena_resident - returns the bytes of the pages of an arena's heap
+ *    that are in memory, as reported by mincore
+ */
+size_t mem_arena_resident(mem_arena_t *arena)
+{
+    char *start = arena->start_brk;
+    char *end = PAGE_UP(arena->brk);
+    size_t pages = (end - start) / mem_pagesize();
+    size_t i, resident = 0;
+    unsigned char *vec;
+
+    if (pages == 0)
+	return 0;
+    if ((vec = (unsigned char *)malloc(pages)) == NULL)
+	return 0;
+    if (mincore(start, end - start, vec) == 0) {
+	for (i = 0; i < pages; i++)
+	    if (vec[i] & 1)
+		resident++;
+    }
+    free(vec);
+    return resident * mem_pagesize();
+}
+
+/*
+ * mem_arena_of - return the arena whose heap holds address p, or NULL 
+ *    if p is not in any arena
+ */
+mem_arena_t *mem_arena_of(void *p)
+{
+    int n = __atomic_load_n(&num_arenas, __ATOMIC_ACQUIRE);
+    int i;
+
+    if (n > MAX_ARENAS)
+	n = MAX_ARENAS;
+    for (i = 0; i < n; i++) {
+	mem_arena_t *arena = &arenas[i];
+
+	if (__atomic_load_n(&arena->ready, __ATOMIC_ACQUIRE) &&
+	    (char *)p >= arena->start_brk && (char *)p < arena->brk)
+	    return arena;
+    }
+    return NULL;
+}
+
+/*
+ * mem_arena_pagesize - returns the size of the pages backing an arena
+ */
+size_t mem_arena_pagesize(mem_arena_t *arena)
+{
+    return arena->pagesize;
+}
+
+/*
+ * mem_node_arena - returns the arena of a NUMA node, the default arena 
+ *    for node 0. The arena of another node is created the first time 
+ *    it is asked for, backed like the default arena. A node above the 
+ *    ones of the machine shares the memory of node % mem_num_nodes(), 
+ *    so more nodes than there are can be simulated. Not thread safe, 
+ *    returns NULL if out of arenas.
+ */
+mem_arena_t *mem_node_arena(int node)
+{
+    mem_arena_t *arena;
+
+    if (node < 0 || node >= MAX_ARENAS)
+	return NULL;
+    if (node_arenas[node] != NULL)
+	return node_arenas[node];
+
+    if (node == 0)
+	arena = &arenas[0];
+    else if ((arena = mem_arena_create_flags(MAX_HEAP, default_flags)) == NULL)
+	return NULL;
+    arena_bind(arena, node);
+    node_arenas[node] = arena;
+    return arena;
+}
+
+/*
+ * map_lock_acquire/map_lock_release - a spin lock for the mapped regions,
+ *    which may be changed by several threads at once
+ */
+static void map_lock_acquire(void)
+{
+    while (__atomic_test_and_set(&map_lock, __ATOMIC_ACQUIRE))
+	;
+}
+
+static void map_lock_release(void)
+{
+    __atomic_clear(&map_lock, __ATOMIC_RELEASE);
+}
+
+/*
+ * arena_pagesize - returns the page size of the arena whose storage 
+ *    holds p, which may lie above its brk, or the system page size
+ */
+static size_t arena_pagesize(void *p)
+{
+    int n = __atomic_load_n(&num_arenas, __ATOMIC_ACQUIRE);
+    int i;
+
+    if (n > MAX_ARENAS)
+	n = MAX_ARENAS;
+    for (i = 0; i < n; i++)
+	if (__atomic_load_n(&arenas[i].ready, __ATOMIC_ACQUIRE) &&
+	    (char *)p >= arenas[i].start_brk && (char *)p < arenas[i].max_addr)
+	    return arenas[i].pagesize;
+    return mem_pagesize();
+}
+
+/*
+ * arena_bind - ask for the pages of an arena to come from the memory of
+ *    a node, there is nothing to ask on a machine with a single node
+ */
+static void arena_bind(mem_arena_t *arena, int node)
+{
+    unsigned long mask;
+
+    if (mem_num_nodes() < 2)
+	return;
+    mask = 1UL << (node % mem_num_nodes());
+    if (syscall(SYS_mbind, arena->start_brk, arena->max_addr - arena->start_brk,
+		MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0) < 0)
+	fprintf(stderr, "mem_node_arena: mbind to node %d failed\n", node);
+}
+
+/*
+ * update_footprint - raise the peak footprint to the current one, 
+ *    called with the map lock held
+ */
+static void update_footprint(void)
+{
+    size_t footprint = map_bytes;
+    int i;
+
+    for (i = 0; i < num_arenas && i < MAX_ARENAS; i++)
+	if (__atomic_load_n(&arenas[i].ready, __ATOMIC_ACQUIRE))
+	    footprint += mem_arena_heapsize(&arenas[i]);
+
+    if (footprint > peak_footprint)
+	peak_footprint = footprint;
+}
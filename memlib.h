@@ -1,11 +1,43 @@
 #include <unistd.h>
 
+/* A simulated heap with its own brk pointer */
+typedef struct mem_arena mem_arena_t;
+
+/* How the storage of an arena is backed */
+#define MEM_HUGE_PAGES 0x1  /* 2 MB aligned and advised to use transparent huge pages */
+#define MEM_POPULATE   0x2  /* faulted in up front */
+
 void mem_init(void);               
+void mem_init_flags(int flags);
 void mem_deinit(void);
 void *mem_sbrk(int incr);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_peak_heapsize(void);
+size_t mem_resident(void);
+size_t mem_release(void *lo, size_t len);
+void *mem_map(size_t size);
+void mem_unmap(void *p);
+void *mem_remap(void *p, size_t size);
+void mem_unmap_all(void);
+int mem_mapped(void *lo, size_t len);
+size_t mem_mapsize(void);
 size_t mem_pagesize(void);
+size_t mem_heap_pagesize(void);
+int mem_num_nodes(void);
 
+mem_arena_t *mem_default_arena(void);
+mem_arena_t *mem_arena_create(size_t size);
+mem_arena_t *mem_arena_create_flags(size_t size, int flags);
+void mem_arena_reset_brk(mem_arena_t *arena);
+void *mem_arena_sbrk(mem_arena_t *arena, int incr);
+void *mem_arena_lo(mem_arena_t *arena);
+void *mem_arena_hi(mem_arena_t *arena);
+size_t mem_arena_heapsize(mem_arena_t *arena);
+size_t mem_arena_peak_heapsize(mem_arena_t *arena);
+size_t mem_arena_resident(mem_arena_t *arena);
+mem_arena_t *mem_arena_of(void *p);
+size_t mem_arena_pagesize(mem_arena_t *arena);
+mem_arena_t *mem_node_arena(int node);
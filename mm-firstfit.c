@@ -33,6 +33,7 @@
 #include <stdlib.h>
 #include "mm.h"
 #include "memlib.h"
+#include "backend.h"
 
 /* Team structure */
 team_t team = {
@@ -46,6 +47,7 @@ team_t team = {
 /* Basic constants and macros */
 #define WSIZE       4       /* word size (bytes) */  
 #define DSIZE       8       /* doubleword size (bytes) */
+#define QSIZE       16      /* quadword size, payloads are aligned to it (bytes) */
 #define CHUNKSIZE  (1<<12)  /* initial heap size (bytes) */
 #define OVERHEAD    8       /* overhead of header and footer (bytes) */
 
@@ -55,8 +57,8 @@ team_t team = {
 #define PACK(size, alloc)  ((size) | (alloc))
 
 /* Read and write a word at address p */
-#define GET(p)       (*(size_t *)(p))
-#define PUT(p, val)  (*(size_t *)(p) = (val))  
+#define GET(p)       (*(unsigned int *)(p))
+#define PUT(p, val)  (*(unsigned int *)(p) = (val))  
 
 /*(which is about 54/100).* Read the size and allocated fields from address p */
 #define GET_SIZE(p)  (GET(p) & ~0x7)
@@ -64,11 +66,11 @@ team_t team = {
 
 /* Given block ptr bp, compute address of its header and footer */
 #define HDRP(bp)       ((char *)(bp) - WSIZE)  
-#define FTRP(bp)       ((char *)(bp) + GET_SIZE(HDRP(bp)) - REQSIZE)
+#define FTRP(bp)       ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
 
 /* Given block ptr bp, compute address of next and previous blocks */
 #define NEXT_BLKP(bp)  ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)))
-#define PREV_BLKP(bp)  ((char *)(bp) - GET_SIZE(((char *)(bp) - REQSIZE)))
+#define PREV_BLKP(bp)  ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
 /* $end mallocmacros */
 
 /* Global variables */
@@ -122,7 +124,7 @@ void *mm_malloc(size_t size)
     if (size <= DSIZE)
 	asize = DSIZE + OVERHEAD;
     else
-	asize = DSIZE * ((size + (OVERHEAD) + (DSIZE-1)) / DSIZE);
+	asize = QSIZE * ((size + (OVERHEAD) + (QSIZE-1)) / QSIZE);
     
     /* Search the free list for a fit */
     if ((bp = find_fit(asize)) != NULL) {
@@ -186,9 +188,11 @@ void mm_checkheap(int verbose)
 
     if ((GET_SIZE(HDRP(heap_listp)) != DSIZE) || !GET_ALLOC(HDRP(heap_listp)))
 	printf("Bad prologue header\n");
-    checkblock(heap_listp);
+    if (verbose)
+	printblock(heap_listp);
 
-    for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+    /* The prologue payload is not QSIZE aligned, the blocks after it are */
+    for (bp = NEXT_BLKP(heap_listp); GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
 	if (verbose) 
 	    printblock(bp);
 	checkblock(bp);
@@ -200,6 +204,30 @@ void mm_checkheap(int verbose)
 	printf("Bad epilogue header\n");
 }
 
+/* 
+ * mm_heapstats - Sum up the free blocks of the heap 
+ */
+void mm_heapstats(heapstats_t *stats)
+{
+    char *bp;
+    size_t size;
+    int class;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->heap_bytes = mem_heapsize();
+    for (bp = NEXT_BLKP(heap_listp); (size = GET_SIZE(HDRP(bp))) > 0; bp = NEXT_BLKP(bp)) {
+	if (GET_ALLOC(HDRP(bp)))
+	    continue;
+	for (class = 0; class < HEAPSTATS_CLASSES - 1 && size >= (size_t)32 << class; class++)
+	    ;
+	stats->free_hist[class]++;
+	stats->free_blocks++;
+	stats->free_bytes += size;
+	if (size > stats->largest_free)
+	    stats->largest_free = size;
+    }
+}
+
 /* The remaining routines are internal helper routines */
 
 /* 
@@ -211,8 +239,8 @@ static void *extend_heap(size_t words)
     char *bp;
     size_t size;
 	
-    /* Allocate an even number of words to maintain alignment */
-    size = (words % 2) ? (words+1) * WSIZE : words * WSIZE;
+    /* Allocate a multiple of four words to maintain alignment */
+    size = ((words + 3) / 4) * 4 * WSIZE;
     if ((bp = mem_sbrk(size)) == (void *)-1) 
 	return NULL;
 
@@ -307,7 +335,7 @@ static void *coalesce(void *bp)
 
 static void printblock(void *bp) 
 {
-    size_t hsize, halloc, fsize, falloc;
+    unsigned int hsize, halloc, fsize, falloc;
 
     hsize = GET_SIZE(HDRP(bp));
     halloc = GET_ALLOC(HDRP(bp));  
@@ -319,16 +347,18 @@ static void printblock(void *bp)
 	return;
     }
 
-    printf("%p: header: [%d:%c] footer: [%d:%c]\n", bp, 
+    printf("%p: header: [%u:%c] footer: [%u:%c]\n", bp, 
 	   hsize, (halloc ? 'a' : 'f'), 
 	   fsize, (falloc ? 'a' : 'f')); 
 }
 
 static void checkblock(void *bp) 
 {
-    if ((size_t)bp % 8)
-	printf("Error: %p is not doubleword aligned\n", bp);
+    if ((size_t)bp % QSIZE)
+	printf("Error: %p is not quadword (16-byte) aligned\n", bp);
     if (GET(HDRP(bp)) != GET(FTRP(bp)))
 	printf("Error: header does not match footer\n");
 }
 
+MM_BACKEND_EXT("firstfit", mm_init, mm_malloc, mm_free, mm_realloc, mm_checkheap,
+	       NULL, NULL, NULL, NULL, NULL, mm_heapstats)
@@ -1,14 +1,20 @@
 /*
- * mm.c - Explicit free list solution using LIFO free policy, optimal fit placement and boundary tag coalescing.
+ * mm.c - Explicit free list solution using LIFO free policy, segregated fit placement (best fit for big blocks) and boundary tag coalescing.
  *
  * Our solution is an explicit free list. We  free blocks using the LIFO policy for simplicity, that is a newly freed block will be added 
  * at the begining/root of our free list. For our list we will need 2 extra word per each block for our links, that is the forward
  * and back pointer since our next free block could be anywhere in the physical memory, that is the list does not lie linear in memory
  * and therefore it is not sufficient to just store the size of each block as you can do in the implicit list. We will also still
  * need our boundary tags like in the implicit list solution for the coalescing method. We will call coalesce everytime
- * we free a block (imideate coalesce), we plan on calling coalesce when freeing and when we are expanding the heap
- * We are going to store a pointer to the start of our free list in a global varialble and this variable will
- * be reset at initilazation.
+ * we free a block (imideate coalesce), we plan on calling coalesce when freeing and when we are expanding the heap.
+ * Only free blocks carry a footer, an allocated block just has its header. Instead the header keeps a bit that tells
+ * if the previous block is allocated, so coalesce only looks at the footer of the previous block when it is free.
+ * The free blocks are kept in segregated lists indexed in two levels like in TLSF: the first level is a power-of-two
+ * size class and the second level splits each class into SL_COUNT equally sized bins. The heads of the lists are
+ * stored in a global array that is reset at initilazation. A free block is always inserted at the start of the list
+ * for its bin. We keep a bitmap of the non-empty bins for each class and a bitmap of the classes that have any
+ * non-empty bin, so finding the first bin that is big enough for a request is a couple of ctz instructions instead
+ * of a walk over empty list heads.
  *
  *  This is how each free block should be structured:
  *
@@ -16,6 +22,52 @@
  *      | Size boundary tag| Nexr ptr | Prev ptr | Payload & padding | Size bounadry tag |
  *      |--------------------------------------------------------------------------------|
  *
+ *  And this is how each allocated block is structured:
+ *
+ *      |-----------------------------------------|
+ *      | Size boundary tag | Payload & padding   |
+ *      |-----------------------------------------|
+ *
+ *  Requests of at most SLAB_MAX bytes do not get a block of their own. They are served from runs, a run is a
+ *  RUN_SIZE aligned allocated block that is split into equally sized slots for one small size class. A slot has no
+ *  header, free slots are linked together through their first word and we find the run of a slot by rounding its
+ *  address down to RUN_SIZE. The run_map has one entry per RUN_SIZE of the heap that tells if a run starts there,
+ *  which is how heap_free tells slots apart from the boundary tagged blocks.
+ *
+ *      |----------------------------------------------------------------|
+ *      | Free slot ptr | Next run | Prev run | Used count | Slot | Slot |...
+ *      |----------------------------------------------------------------|
+ *
+ *  When built with MM_BESTFIT free blocks of at least TREE_MIN bytes are not kept in the bins but in a treap ordered
+ *  by (size, address), so a big request always gets the smallest block that fits it, the lowest one of those if
+ *  there are several. The node is stored in the two link words of the free block and its priority is a hash of the
+ *  block address, so a tree block has the same layout as any other free block.
+ *
+ *  Requests of at least MMAP_THRESHOLD bytes are not kept in the heap at all, each one gets a region of its own from
+ *  mem_map. The header in front of the payload has the MAPPED bit set and holds the size of the region, freeing the
+ *  block unmaps the region and resizing it remaps it, so big blocks never end up on the free lists.
+ *
+ *  When built with MM_DEFERRED a freed block of at most FAST_MAX bytes is not coalesced right away. It stays marked
+ *  allocated and goes on a quick list that only holds blocks of its exact size, so a malloc of the same size right
+ *  after takes it back without splitting anything. The quick lists are coalesced into the free lists all at once when
+ *  a malloc finds no free block, or when they hold more than FAST_BUDGET bytes.
+ *
+ *  When built with MM_THREADSAFE there is one heap like the above for each NUMA node, in an arena whose pages come
+ *  from that node, and each one is guarded by a lock of its own. A thread allocates from the heap of the node it ran
+ *  on when it first allocated. In front of it every thread keeps a cache of recently freed blocks for each small
+ *  request size, so most malloc/free pairs never take a lock. A cache is refilled from and flushed back to the heap
+ *  TC_BATCH blocks at a time. A thread that frees a block of another node's heap does not take that heap's lock, it
+ *  pushes the block on the heap's remote queue, which is emptied by the next thread to take the lock.
+ *
+ *  mm_memalign gives a request an aligned payload inside a free block, the slack in front of it becomes a free block
+ *  of its own that is coalesced like any other when its neighbours are freed.
+ *
+ *  mm_free_sized and mm_realloc_sized take the size the block was last allocated or reallocated with, like a sized
+ *  operator delete does. A slot never holds more than SLAB_MAX bytes and a mapped block is never below
+ *  MMAP_THRESHOLD, so the size alone tells which kind of block it is. In the thread safe build every block of a
+ *  cache class size holds the biggest request of its class, so a small block goes into the cache by its size
+ *  without a look at its header or the run map.
+ *
  *  And this is how the list it self should be structured (pretty much the same idea as in the implicit list solution):
  *
  *      |-------------------------------------------------------------------------|
@@ -28,8 +80,39 @@
 #include <unistd.h>
 #include <string.h>
 
+#ifndef MM_THREADSAFE
+#define MM_THREADSAFE 0
+#endif
+
+#ifndef MM_BESTFIT
+#define MM_BESTFIT 1
+#endif
+
+#ifndef MM_DEFERRED
+#define MM_DEFERRED 0
+#endif
+
+//MM_DEBUG checks the sizes callers give to mm_free_sized and mm_realloc_sized against the blocks
+#ifndef MM_DEBUG
+#define MM_DEBUG 0
+#endif
+
+//the name this package registers under, so the driver can run both builds side by side
+#if MM_DEFERRED
+#define MM_NAME "mm-deferred"
+#else
+#define MM_NAME "mm"
+#endif
+
+#if MM_THREADSAFE
+#include <pthread.h>
+#include <sys/syscall.h>
+#endif
+
 #include "mm.h"
 #include "memlib.h"
+#include "config.h"
+#include "backend.h"
 
 /*********************************************************
  * === User information ===
@@ -61,44 +144,139 @@ team_t team =
 
 /* Basic constants and macros (from mm-firstfit.c)*/
 
-#define REQSIZE     8       /* doubleword size (bytes) */
-#define OVERHEAD    8       /* overhead of header and footer (bytes) */
-#define WSIZE       4       /* word size (bytes) */
-#define CHUNKSIZE  (1<<12)  /* initial heap size (bytes) */
-
-/* single word (4) or double word (8) alignment */
-#define ALIGNMENT 8
+#define REQSIZE     16      /* block sizes and payload addresses are multiples of this (bytes) */
+#define WSIZE       4       /* word size, the size of a header or footer tag (bytes) */
+#define PSIZE       4       /* size of a free list link, an offset from heap_base (bytes) */
+#define OVERHEAD    (2 * WSIZE) /* overhead of header and footer (bytes) */
+#define MIN_BLOCK   ALIGN(2 * PSIZE + OVERHEAD) /* smallest block, must be able to hold a free block */
+#define CHUNKSIZE  (1<<12)  /* initial heap size and least extension (bytes), see chunk_size */
+#define REALLOC_HEADROOM 1  /* a moved block gets 1/2^REALLOC_HEADROOM of its size extra */
+#define TRIM_THRESHOLD (1<<20) /* a free last block this big is trimmed down to TRIM_KEEP bytes... */
+#define TRIM_KEEP      (1<<18)
+#define RELEASE_THRESHOLD (1<<21) /* ...and the pages inside any other free block this big are released */
+#define RELEASE_BUDGET (1<<20) /* smaller spans freed into such a block wait until they add up to this many bytes */
+
+#ifndef MMAP_THRESHOLD
+#define MMAP_THRESHOLD (1<<17) /* requests of at least this many bytes get a mapped region of their own */
+#endif
+#define MAP_HDRSIZE REQSIZE    /* a mapped block's payload starts this far into its region, to stay aligned */
+
+/* Segregated free list constants */
+#define NUM_CLASSES 20                      /* number of size classes, the last class holds everything bigger */
+#define MIN_CLASS   4                       /* log2 of the smallest block size class */
+#define SL_BITS     2                       /* log2 of the number of bins in each size class */
+#define SL_COUNT    (1 << SL_BITS)          /* number of bins in each size class */
+#define NUM_BINS    (NUM_CLASSES * SL_COUNT)
+
+/* Best fit tree, only used when built with MM_BESTFIT */
+#define TREE_MIN    (1 << 12)               /* free blocks this big go into the tree instead of the bins */
+
+/* Quick lists, only used when built with MM_DEFERRED */
+#define FAST_MAX    512                     /* freed blocks of at most this many bytes go on a quick list */
+#define FAST_LISTS  (FAST_MAX / REQSIZE + 1) /* one quick list per block size */
+#define FAST_BUDGET (1 << 16)               /* the quick lists are coalesced when they hold this many bytes */
+
+/* Given a size class and a bin inside the class, compute the index into free_lists */
+#define BIN(class, sl) ((class) * SL_COUNT + (sl))
+
+/* Small object runs */
+#define SLAB_MAX     64                     /* biggest request served from a run (bytes) */
+#define SLAB_CLASSES (SLAB_MAX / REQSIZE)   /* one slot size per multiple of REQSIZE */
+#define RUN_SHIFT    12
+#define RUN_SIZE     (1 << RUN_SHIFT)       /* size and alignment of a run (bytes) */
+#define RUN_HDRSIZE  ALIGN(4 * PSIZE)       /* free slot ptr, next and prev run ptr and used count */
+#define RUN_MAPSIZE  (MAX_HEAP / RUN_SIZE + 1)
+
+/* Given a small request size, compute its slab class and the slot size of a slab class */
+#define SLAB_CLASS(size)  (((size) - 1) / REQSIZE)
+#define SLOT_SIZE(class)  (((class) + 1) * REQSIZE)
+
+/* Given run ptr rp, compute address of its free slot list, next and prev run links and used count */
+#define RUN_FREE(rp)   ((char *)(rp))
+#define RUN_NEXT(rp)   ((char *)(rp) + PSIZE)
+#define RUN_PREV(rp)   ((char *)(rp) + 2 * PSIZE)
+#define RUN_USED(rp)   ((char *)(rp) + 3 * PSIZE)
+
+/* Given slot ptr sp, compute its run and its index into the run_map of heap h, or of the current heap */
+#define RUNP(sp)       ((char *)((size_t)(sp) & ~(size_t)(RUN_SIZE - 1)))
+#define RUN_INDEX_IN(h, sp) (((size_t)(sp) >> RUN_SHIFT) - ((size_t)(h)->heap_base >> RUN_SHIFT))
+#define RUN_INDEX(sp)  RUN_INDEX_IN(heap, sp)
+
+/* payload alignment, 16 bytes like the system malloc on x86-64 and aarch64 */
+#define ALIGNMENT 16
 
 /* rounds up to the nearest multiple of ALIGNMENT */
-#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
+#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(ALIGNMENT-1))
 
 
 #define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
 
 #define MAX(x, y) ((x) > (y)? (x) : (y))
+#define MIN(x, y) ((x) < (y)? (x) : (y))
 
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc)  ((size) | (alloc))
 
+/* The second lowest bit of a header tells if the previous block is allocated */
+#define PREV_ALLOC  0x2
+
+/* The third lowest bit of a header tells that the block has a mapped region of its own */
+#define MAPPED      0x4
+
 /* Read and write a word at address p */
-#define GET(p)       (*(size_t *)(p))
-#define PUT(p, val)  (*(size_t *)(p) = (val))
+#define GET(p)       (*(unsigned int *)(p))
+#define PUT(p, val)  (*(unsigned int *)(p) = (val))
+
+/* Read and write a free list link at address p, links are kept as 32 bit offsets from heap_base and the
+   padding word at offset 0 is never a block, so offset 0 means NULL */
+#define GET_PTR(p)       (GET(p) ? heap->heap_base + GET(p) : NULL)
+#define PUT_PTR(p, val)  PUT(p, (val) ? (unsigned int)((char *)(val) - heap->heap_base) : 0)
 
 /* Read the size and allocated fields from address p */
 #define GET_SIZE(p)  (GET(p) & ~0x7)
 #define GET_ALLOC(p) (GET(p) & 0x1)
+#define GET_PREV_ALLOC(p) (GET(p) & PREV_ALLOC)
+#define GET_MAPPED(p) (GET(p) & MAPPED)
+
+/* Set or clear the previous allocated bit of the header at address p */
+#define SET_PREV_ALLOC(p)   PUT(p, GET(p) | PREV_ALLOC)
+#define CLEAR_PREV_ALLOC(p) PUT(p, GET(p) & ~PREV_ALLOC)
 
 /* Given block ptr bp, compute address of its header and footer */
 #define NEXT_PTR(bp)       ((char *)(bp))
-#define PREV_PTR(bp)       ((char *)(bp) + WSIZE)
+#define PREV_PTR(bp)       ((char *)(bp) + PSIZE)
+
+/* Given free tree block ptr bp, compute address of its children and get its treap priority */
+#define TREE_LEFT(bp)  NEXT_PTR(bp)
+#define TREE_RIGHT(bp) PREV_PTR(bp)
+#define TREE_PRIO(bp)  ((unsigned int)((size_t)(bp) * 2654435761u))
 
 /* Given block ptr bp, compute address of its header and footer */
 #define HDRP(bp)       ((char *)(bp) - WSIZE)
-#define FTRP(bp)       ((char *)(bp) + GET_SIZE(HDRP(bp)) - REQSIZE)
+#define FTRP(bp)       ((char *)(bp) + GET_SIZE(HDRP(bp)) - OVERHEAD)
 
-/* Given block ptr bp, compute address of next and previous blocks */
+/* Given block ptr bp, compute address of next and previous blocks, PREV_BLKP is only valid if the previous block is free */
 #define NEXT_BLKP(bp)  ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)))
-#define PREV_BLKP(bp)  ((char *)(bp) - GET_SIZE(((char *)(bp) - REQSIZE)))
+#define PREV_BLKP(bp)  ((char *)(bp) - GET_SIZE(((char *)(bp) - OVERHEAD)))
+
+/* NUMA nodes, the thread safe build keeps a heap for each node of the machine, or for MM_NODES of them */
+#if MM_THREADSAFE
+#define MAX_NODES   8
+#else
+#define MAX_NODES   1
+#endif
+
+/* Per thread caches, only used when built with MM_THREADSAFE */
+#define TC_CLASSES  32                      /* requests of up to TC_CLASSES * REQSIZE bytes (512) are cached */
+#define TC_CAP      32                      /* most blocks a thread keeps in each class */
+#define TC_BATCH    16                      /* blocks moved between a cache and the heap at a time */
+
+/* Given a request size, compute its cache class, and the request size every block in a cache class can hold */
+#define TC_CLASS(size)   (((size) - 1) / REQSIZE)
+#define TC_SIZE(class)   (((class) + 1) * REQSIZE)
+
+/* Read and write the link to the next cached block, kept in the payload */
+#define TC_NEXT(bp)  (*(void **)(bp))
 
 /* Print debugging information */
 extern int verbose;
@@ -110,390 +288,2068 @@ extern int verbose;
 # define PRINT_FUNC
 #endif
 
+/* One heap and its free lists, the thread safe build has one of these for each NUMA node */
+typedef struct {
+    mem_arena_t *arena;                 /* the simulated memory the heap grows in */
+    char *free_lists[NUM_BINS];         /* The start of the free list for each bin */
+    unsigned int class_map;             /* bit i is set if size class i has a non-empty bin */
+    unsigned int bin_map[NUM_CLASSES];  /* bit j of entry i is set if bin j of class i is non-empty */
+    char *free_tree;                    /* root of the best fit tree */
+    char *fast_lists[FAST_LISTS];       /* freed blocks of each size that wait to be coalesced */
+    size_t fast_bytes;                  /* bytes held on the quick lists */
+    size_t dirty_bytes;                 /* bytes freed into released blocks that wait for RELEASE_BUDGET */
+    size_t chunk_size;                  /* the heap grows to a multiple of this, a huge page if it is backed by them */
+
+    char *heap_base;                    /* first byte of the heap, run_map and the links are relative to it */
+    char *slab_runs[SLAB_CLASSES];      /* runs of each slab class that have a free slot */
+    unsigned char run_map[RUN_MAPSIZE]; /* slab class + 1 of the run starting in each RUN_SIZE, 0 if none */
+#if MM_THREADSAFE
+    pthread_mutex_t lock;               /* guards everything above */
+    void *remote;                       /* blocks freed by threads of other nodes, pushed without the lock */
+#endif
+} heap_t;
+
 //static char *heap_start;  /* pointer to the start of out heap. Note this is only global for debuging purposes*/
-static char *free_startp; /* This points to the beginning of the free list */
+static heap_t heaps[MAX_NODES];         /* heaps[i] grows in the arena of NUMA node i */
+static int num_heaps;                   /* heaps in use, set by mm_init */
+
+#if MM_THREADSAFE
+typedef struct {
+    unsigned int gen;                   /* heap generation the cached blocks belong to */
+    int registered;                     /* the cache is flushed when the thread exits */
+    heap_t *home;                       /* the heap of the thread's node, all cached blocks are from it */
+    int count[TC_CLASSES];              /* number of cached blocks in each class */
+    void *head[TC_CLASSES];             /* the cached blocks of each class */
+} tcache_t;
+
+static __thread heap_t *heap;           /* the heap the heap_xxx functions work on, the one whose lock we hold */
+static pthread_once_t heaps_once = PTHREAD_ONCE_INIT;
+static unsigned int next_home;          /* spreads threads over simulated nodes */
+static unsigned int heap_gen;           /* bumped by mm_init, so caches know their blocks are gone */
+static __thread tcache_t tcache;        /* the cache of the calling thread */
+static pthread_key_t tcache_key;        /* only used to flush the cache at thread exit */
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+
+static tcache_t *tcache_get(void);
+static void tcache_flush(tcache_t *tc, int class, int count);
+static void tcache_exit(void *arg);
+static void tcache_key_init(void);
+static int block_tc_class(heap_t *h, void *ptr);
+static size_t tc_round(size_t size);
+static void heaps_lock_init(void);
+static heap_t *heap_acquire(heap_t *h);
+static void heap_release(void);
+static heap_t *heap_of(void *ptr);
+static heap_t *home_heap(void);
+static void remote_free(heap_t *h, void *ptr);
+static int heaps_wanted(void);
+#else
+static heap_t *const heap = &heaps[0];  /* the one heap */
+#endif
 
 static void *scan_for_free(size_t adjsize);
 static void *new_free_block(size_t words);
+static size_t extension(size_t size);
 static void place(void *alloc_ptr, size_t size_needed);
 static void *coalesce(void *middle);
-/*
-static void mm_checkheap();
+static void checkheap(int verbose);
+static void heapstats(heapstats_t *stats);
+static int checktree(char *node);
 static void printblock(void *bp);
 static void checkblock(void *bp);
-*/
 static void mm_insert(void *block);
 static void mm_delete(void *block);
+static int size_bin(size_t size);
+static char *tree_insert(char *root, char *block);
+static void tree_delete(char *block);
+static void tree_replace(char *parent, char *old, char *new);
+static char *tree_best(size_t size);
+static int heap_init(void);
+static void *heap_malloc(size_t size);
+static void heap_free(void *block);
+static void heap_free_sized(void *block, size_t size);
+static void *heap_realloc(void *ptr, size_t oldsize, size_t size);
+static int heap_malloc_batch(size_t size, void **ptrs, int n);
+static void heap_free_batch(void **ptrs, int n);
+static int carve(char *block, size_t adjsize, int n, void **ptrs);
+static int ptr_cmp(const void *a, const void *b);
+static void *heap_memalign(size_t align, size_t size);
+static void *alloc_aligned(size_t adjsize, size_t align);
+static char *aligned_payload(char *block, size_t adjsize, size_t align);
+static void free_block(void *block);
+static void trim_heap(void *block);
+static void fast_free(void *block);
+static void fast_coalesce(void);
+static void *map_malloc(size_t size);
+static void map_free(void *block);
+static void *map_realloc(void *block, size_t size);
+static void *slab_malloc(size_t size);
+static int slab_malloc_batch(size_t size, void **ptrs, int n);
+static void slab_free(void *slot);
+static void *new_run(int class);
+static void run_unlink(char *run, int class);
+#if MM_DEBUG
+static void check_size_hint(void *ptr, size_t size);
+#endif
 
 /*
- * mm_init - should find the start of the heap and reserve some initial space.
+ * mm_init - initialize the heap, in the thread safe build the heaps of all nodes and the caches of all threads are
+ *           dropped.
  */
 int mm_init(void)
 {
-    char *heap_start;
-
-    PRINT_FUNC;
-
-    heap_start = mem_sbrk(4 * WSIZE); //increment the break pointer by two double words
-
-    if (heap_start == NULL)
-    {
-        return -1; //No more space for heap;
-    }
-                                                                            //                      -----------
-    PUT(heap_start, 0);                                                     // padding              | padding |
-                                                                            //                      |---------|
-    PUT(heap_start + WSIZE, PACK(OVERHEAD, 1));                             // prolog header        |   PH    |
-                                                                            //                      |---------|
-    PUT(heap_start + REQSIZE, PACK(OVERHEAD, 1));                           // prolog footer        |   PF    |
-                                                                            //                      |---------|
-    PUT(heap_start + REQSIZE + WSIZE, PACK(0, 1));                          // epilog header        |   EH    |
-                                                                            //                      -----------
-    heap_start += REQSIZE;
+#if MM_THREADSAFE
+    int ret = 0;
+    int i;
 
-    free_startp = NULL;
-    //initilize some starting free space
-    free_startp = new_free_block(CHUNKSIZE / WSIZE);
+    pthread_once(&heaps_once, heaps_lock_init);
+    num_heaps = heaps_wanted();
+    next_home = 0;
 
-    //no more space available
-    if (free_startp == NULL)   
+    for (i = 0; i < num_heaps && ret == 0; i++)
     {
-        return -1;
-    }
+        if ((heaps[i].arena = mem_node_arena(i)) == NULL)
+        {
+            return -1;
+        }
 
-    if (VERBOSED)
-    {
-        printf("\n");
-        printf("Free list start pointer: %p\n", free_startp);
+        pthread_mutex_lock(&heaps[i].lock);
+        heap = &heaps[i];
+        heap->remote = NULL;
+        ret = heap_init();
+        pthread_mutex_unlock(&heaps[i].lock);
     }
+    __atomic_add_fetch(&heap_gen, 1, __ATOMIC_RELEASE);
 
-    return 0;
+    return ret;
+#else
+    heaps[0].arena = mem_default_arena();
+    num_heaps = 1;
+    return heap_init();
+#endif
 }
 
 /*
- * new_free_block - gets amount of words as input, increments brk pointer by needed bytes for requested word(s).
- *                  constructs the new free block with size tags, next and prev pointers and adjusts the epilog
- *                  footer.
+ * mm_malloc - allocate a block of at least size bytes, the thread safe build first looks in the thread's cache and
+ *             else allocates from the heap of the thread's node.
  */
-static void *new_free_block(size_t words)
+void *mm_malloc(size_t size)
 {
-    PRINT_FUNC;
-
-    char *new_block;   //pointer to the new free/clean block
-    size_t bytes;     //the number of bytes needed for the amount of words
+#if MM_THREADSAFE
+    tcache_t *tc;
+    void *block;
+    int class;
+    int i;
 
-    if (words < 2)
+    if (size == 0)
     {
-        return NULL; //not enough space for next and prev pointers
+        return NULL;
     }
 
-    if (words % 2)    //need to keep alignment as an even number
-    {
-        bytes = (words + 1) * WSIZE;
-    }
-    else
+    //a mapped block has nothing to do with the heap, so the lock is not needed
+    if (size >= MMAP_THRESHOLD)
     {
-        bytes = words * WSIZE;
+        return map_malloc(size);
     }
 
-    new_block = mem_sbrk(bytes);  //increment the brk pointer to get more space
+    tc = tcache_get();
 
-    if (new_block == (void *) - 1)
+    if (size > TC_SIZE(TC_CLASSES - 1))
     {
-        return NULL;    //something went terribly wrong
+        heap_acquire(tc->home);
+        block = heap_malloc(size);
+        heap_release();
+        return block;
     }
 
-    PUT(HDRP(new_block), PACK(bytes, 0));   //adding header size boundary tag
-    PUT(FTRP(new_block), PACK(bytes, 0));   //adding footer sixe boundary tag
+    class = TC_CLASS(size);
 
-    //adjusting the epilog header
-    PUT(HDRP(NEXT_BLKP(new_block)), PACK(0, 1));     
+    if ((block = tc->head[class]) != NULL)
+    {
+        tc->head[class] = TC_NEXT(block);
+        tc->count[class]--;
+        return block;
+    }
 
-    //insert new free block to our list
-    mm_insert(new_block);
+    //refill the cache in one go
+    size = tc_round(size);
+    heap_acquire(tc->home);
+    block = heap_malloc(size);
+    for (i = 1; i < TC_BATCH && block != NULL; i++)
+    {
+        void *extra = heap_malloc(size);
 
-    //mm_checkheap(verbose);
+        if (extra == NULL)
+        {
+            break;
+        }
 
-    return coalesce(new_block);
+        TC_NEXT(extra) = tc->head[class];
+        tc->head[class] = extra;
+        tc->count[class]++;
+    }
+    heap_release();
 
+    return block;
+#else
+    return heap_malloc(size);
+#endif
 }
+
 /*
- * mm_malloc - find a free block that fits our size so that it is a modulo 0 + overhead of 8 bytes
- *             if no space is found we increment mem_sbrk pointer for our new memory
+ * mm_free - free a block, the thread safe build keeps small blocks in the thread's cache and sends a block of
+ *           another node's heap back to it.
  */
-void *mm_malloc(size_t size)
+void mm_free(void *ptr)
 {
-    PRINT_FUNC;
+#if MM_THREADSAFE
+    heap_t *h = heap_of(ptr);
+    tcache_t *tc;
+    int class;
 
-    size_t adjsize;
-    char *allocspacePtr;
-    size_t extend_size;
+    //only mapped blocks are outside of the heaps
+    if (h == NULL)
+    {
+        map_free(ptr);
+        return;
+    }
 
-    /* Base case: 0 */
-    if (size <= 0)
+    tc = tcache_get();
+
+    if (h != tc->home)
     {
-        return NULL;
+        remote_free(h, ptr);
+        return;
     }
 
-    //Must make our size a modulo 0 + overhead of 8 bytes
-    if (size <= REQSIZE)
+    class = block_tc_class(h, ptr);
+
+    if (class >= TC_CLASSES)
     {
-        adjsize = REQSIZE + OVERHEAD;
+        heap_acquire(h);
+        heap_free(ptr);
+        heap_release();
+        return;
     }
-    else
+
+    TC_NEXT(ptr) = tc->head[class];
+    tc->head[class] = ptr;
+
+    //a full cache gives a batch back to the heap
+    if (++tc->count[class] > TC_CAP)
     {
-        adjsize = REQSIZE * ((size + (OVERHEAD) + (REQSIZE - 1)) / REQSIZE);
+        tcache_flush(tc, class, TC_BATCH);
     }
+#else
+    heap_free(ptr);
+#endif
+}
 
-    //scan for free space
-    allocspacePtr = scan_for_free(adjsize);
+/*
+ * mm_free_sized - free a block of the size it was last allocated or reallocated with, a size of 0 means unknown.
+ *                 The thread safe build caches a small block by that size alone.
+ */
+void mm_free_sized(void *ptr, size_t size)
+{
+#if MM_DEBUG
+    if (size != 0)
+    {
+        check_size_hint(ptr, size);
+    }
+#endif
+#if MM_THREADSAFE
+    heap_t *h;
+    tcache_t *tc;
+    int class;
 
-    if (VERBOSED)
+    if (size == 0)
     {
-        printf("AllocspacePtr gave: %p\n", allocspacePtr);
+        mm_free(ptr);
+        return;
     }
 
-    if (allocspacePtr != NULL)
+    if ((h = heap_of(ptr)) == NULL)
     {
-        //found free space that fits the adjusted size
-        place(allocspacePtr, adjsize);
-        return allocspacePtr;
+        map_free(ptr);
+        return;
     }
 
-    extend_size = MAX(adjsize, CHUNKSIZE);
-    
-    //we just allocate more space
-    allocspacePtr = new_free_block(extend_size / WSIZE);
+    tc = tcache_get();
 
-    if (allocspacePtr == NULL)
+    if (h != tc->home)
     {
-        return NULL;
+        remote_free(h, ptr);
+        return;
     }
 
-    //place block in heap
-    place(allocspacePtr, adjsize);
+    if (size > TC_SIZE(TC_CLASSES - 1))
+    {
+        heap_acquire(h);
+        heap_free_sized(ptr, size);
+        heap_release();
+        return;
+    }
 
-    //mm_checkheap(verbose);
+    class = TC_CLASS(size);
+    TC_NEXT(ptr) = tc->head[class];
+    tc->head[class] = ptr;
 
-    return allocspacePtr;
+    if (++tc->count[class] > TC_CAP)
+    {
+        tcache_flush(tc, class, TC_BATCH);
+    }
+#else
+    heap_free_sized(ptr, size);
+#endif
 }
 
 /*
- * place - place block of size adjSize at the start of pointer allocPtr
+ * mm_realloc - resize a block, always done on the heap it is in.
  */
-static void place(void *alloc_ptr, size_t size_needed)
+void *mm_realloc(void *ptr, size_t size)
 {
-    PRINT_FUNC;
-
-    //fetch the size of the block given to us
-    size_t block_size = GET_SIZE(HDRP(alloc_ptr));      
-
-    size_t block_remainder = block_size - size_needed;
+    return mm_realloc_sized(ptr, 0, size);
+}
 
-    //check if reallocating
-    if(!GET_ALLOC(HDRP(alloc_ptr)))
+/*
+ * mm_realloc_sized - resize a block the caller knows the size of, see mm_free_sized. An oldsize of 0 means unknown.
+ *                    A block of another node's heap is resized under that heap's lock and stays in that heap.
+ */
+void *mm_realloc_sized(void *ptr, size_t oldsize, size_t size)
+{
+#if MM_DEBUG
+    if (oldsize != 0)
     {
-        //delete block from our free list
-        mm_delete(alloc_ptr);
+        check_size_hint(ptr, oldsize);
     }
+#endif
+#if MM_THREADSAFE
+    heap_t *h = heap_of(ptr);
+    void *newptr;
 
-    if (block_remainder >= (REQSIZE + OVERHEAD))
-    {
-        //split block in two
-        PUT(HDRP(alloc_ptr), PACK(size_needed, 1));
-        PUT(FTRP(alloc_ptr), PACK(size_needed, 1));
+    size = tc_round(size);
 
-        //We have space for a new free block
-        alloc_ptr = NEXT_BLKP(alloc_ptr);
-        PUT(HDRP(alloc_ptr), PACK(block_remainder, 0));
-        PUT(FTRP(alloc_ptr), PACK(block_remainder, 0));
-        
-        //insert new block to the start of our free list
-        mm_insert(alloc_ptr);
-        
-    }
-    else
-    {
-        //use the whole block
-        PUT(HDRP(alloc_ptr), PACK(block_size, 1));
-        PUT(FTRP(alloc_ptr), PACK(block_size, 1));
-    }
+    //NULL and mapped blocks are in no heap, one that moves into a heap goes into ours
+    heap_acquire(h != NULL ? h : tcache_get()->home);
+    newptr = heap_realloc(ptr, oldsize, size);
+    heap_release();
+
+    return newptr;
+#else
+    return heap_realloc(ptr, oldsize, size);
+#endif
 }
+
 /*
- * mm_delete - deleting a free block from our free list
+ * mm_memalign - allocate a block of at least size bytes whose payload address is a multiple of align, a power of two.
+ *               Returns NULL if align is not a power of two.
  */
-void mm_delete(void *block)
+void *mm_memalign(size_t align, size_t size)
 {
+#if MM_THREADSAFE
+    void *block;
+#endif
 
-    PRINT_FUNC;
-    char *next;
-    char *prev;
-
-    next = (char *)GET(NEXT_PTR(block));
-    prev = (char *)GET(PREV_PTR(block));
+    if (align == 0 || (align & (align - 1)))
+    {
+        return NULL;
+    }
 
-    if (next == NULL && prev != NULL)           //Case 0: At the end of a list
+    //every payload is aligned that much anyway
+    if (align <= ALIGNMENT)
     {
-        GET(NEXT_PTR(prev)) = (size_t)next;
+        return mm_malloc(size);
     }
-    else if (prev == NULL && next != NULL)      //Case 1: At the start of the list
+
+#if MM_THREADSAFE
+    size = tc_round(size);
+    heap_acquire(tcache_get()->home);
+    block = heap_memalign(align, size);
+    heap_release();
+
+    return block;
+#else
+    return heap_memalign(align, size);
+#endif
+}
+
+/*
+ * mm_malloc_batch - allocate n blocks of size bytes in one go and store them in ptrs, returns how many blocks it
+ *                   got, fewer than n only if the heap ran out. The thread safe build first empties the thread's cache.
+ */
+int mm_malloc_batch(size_t size, void **ptrs, int n)
+{
+#if MM_THREADSAFE
+    tcache_t *tc;
+    int class;
+    int got = 0;
+
+    if (size == 0)
     {
-        GET(PREV_PTR(next)) = (size_t)prev;
-        free_startp = next;
+        return 0;
     }
-    else if (prev == NULL && next == NULL)      //Case 2: Only block left in list
+
+    tc = tcache_get();
+
+    if (size <= TC_SIZE(TC_CLASSES - 1))
     {
-        free_startp = NULL;
+        class = TC_CLASS(size);
+
+        while (got < n && tc->head[class] != NULL)
+        {
+            ptrs[got] = tc->head[class];
+            tc->head[class] = TC_NEXT(ptrs[got]);
+            tc->count[class]--;
+            got++;
+        }
     }
-    else if (prev != NULL && next != NULL)      //Case 3: Somewhere in the middle of the list
+
+    if (got < n)
     {
-        GET(NEXT_PTR(prev)) = (size_t)next;
-        GET(PREV_PTR(next)) = (size_t)prev;
+        heap_acquire(tc->home);
+        got += heap_malloc_batch(tc_round(size), ptrs + got, n - got);
+        heap_release();
     }
+
+    return got;
+#else
+    return heap_malloc_batch(size, ptrs, n);
+#endif
 }
+
 /*
- * mm_insert - inserting new free block to our free list.
+ * mm_free_batch - free n blocks in one go, ptrs is sorted by address on the way. The thread safe build frees the
+ *                 small, mapped and remote blocks one by one as mm_free does and the others under one lock.
  */
-void mm_insert(void *block)
+void mm_free_batch(void **ptrs, int n)
 {
+#if MM_THREADSAFE
+    heap_t *home = tcache_get()->home;
+    int i;
+    int k = 0;
 
-    PRINT_FUNC;
-    GET(PREV_PTR(block)) = 0;
-
-    if (free_startp == NULL)                //case 0: Inserting in an empty list
+    for (i = 0; i < n; i++)
     {
-        GET(NEXT_PTR(block)) = 0;
-        free_startp = block;
+        if (heap_of(ptrs[i]) != home || block_tc_class(home, ptrs[i]) < TC_CLASSES)
+        {
+            mm_free(ptrs[i]);
+        }
+        else
+        {
+            ptrs[k++] = ptrs[i];
+        }
     }
-    else                                    //case 1: Inserting in a non empty list
+
+    if (k > 0)
     {
-        GET(PREV_PTR(free_startp)) = (size_t)block;
-        GET(NEXT_PTR(block)) = (size_t)free_startp;
-        free_startp = block;
+        heap_acquire(home);
+        heap_free_batch(ptrs, k);
+        heap_release();
     }
-
+#else
+    heap_free_batch(ptrs, n);
+#endif
 }
+
+#if MM_THREADSAFE
 /*
- * mm_free - Freeing a block but does not coalesce the freed space.
+ * tcache_get - returns the cache of the calling thread, a cache left over from before the last mm_init is emptied
+ *              and the thread is given the heap of its node again.
  */
-void mm_free(void *block)
+static tcache_t *tcache_get(void)
 {
-    PRINT_FUNC;
-
-    size_t ptrSize = GET_SIZE(HDRP(block));
+    tcache_t *tc = &tcache;
+    unsigned int gen = __atomic_load_n(&heap_gen, __ATOMIC_ACQUIRE);
 
-    //Free the header and footer of given pointer
-    PUT(HDRP(block), PACK(ptrSize, 0));
-    PUT(FTRP(block), PACK(ptrSize, 0));
-
-    //insert block at the start of our free list
-    mm_insert(block);
+    if (tc->gen != gen)
+    {
+        memset(tc->count, 0, sizeof(tc->count));
+        memset(tc->head, 0, sizeof(tc->head));
+        tc->home = home_heap();
+        tc->gen = gen;
 
-    //mm_checkheap(verbose);
+        if (!tc->registered)
+        {
+            pthread_once(&tcache_once, tcache_key_init);
+            pthread_setspecific(tcache_key, tc);
+            tc->registered = 1;
+        }
+    }
 
-    coalesce(block);
+    return tc;
 }
 
 /*
- * mm_realloc - Implemented simply in terms of mm_malloc and mm_free
+ * tcache_flush - give count blocks of a class of the cache back to the heap, under one lock.
  */
-void *mm_realloc(void *ptr, size_t size)
+static void tcache_flush(tcache_t *tc, int class, int count)
 {
+    void *block;
 
-    /* 
-     * #1: See if new size is less then the current block size, then we cut the block in half.
-     * #2: See if next block is free, then simply expand.
-     * #3: Need to copy contents to another location
+    heap_acquire(tc->home);
+    while (count-- > 0 && (block = tc->head[class]) != NULL)
+    {
+        tc->head[class] = TC_NEXT(block);
+        tc->count[class]--;
+        heap_free(block);
+    }
+    heap_release();
+}
+
+/*
+ * tcache_exit - flush the whole cache of an exiting thread, unless the heap was initialized again since.
+ */
+static void tcache_exit(void *arg)
+{
+    tcache_t *tc = arg;
+    int class;
+
+    if (tc->gen != __atomic_load_n(&heap_gen, __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+
+    for (class = 0; class < TC_CLASSES; class++)
+    {
+        if (tc->count[class] > 0)
+        {
+            tcache_flush(tc, class, tc->count[class]);
+        }
+    }
+}
+
+/*
+ * tcache_key_init - create the key whose destructor flushes the caches
+ */
+static void tcache_key_init(void)
+{
+    pthread_key_create(&tcache_key, tcache_exit);
+}
+
+/*
+ * block_tc_class - returns the cache class of an allocated block of heap h, that is the class of the biggest request
+ *                  it can hold. The run map and the header of an allocated block do not change, so no lock is needed.
+ */
+static int block_tc_class(heap_t *h, void *ptr)
+{
+    size_t index = RUN_INDEX_IN(h, ptr);
+
+    if (index < RUN_MAPSIZE && h->run_map[index])
+    {
+        return h->run_map[index] - 1;
+    }
+
+    return (GET_SIZE(HDRP(ptr)) - WSIZE) / REQSIZE - 1;
+}
+
+/*
+ * tc_round - round a request of a cache class size up to the biggest request of its class. Any block of the class
+ *            can be handed out from the cache for any request of the class, and mm_free_sized files a block by the
+ *            size it is told, so every block the heap gives out for such a request must be that big. Bigger requests
+ *            and 0 are returned as they are.
+ */
+static size_t tc_round(size_t size)
+{
+    if (size > 0 && size <= TC_SIZE(TC_CLASSES - 1))
+    {
+        return TC_SIZE(TC_CLASS(size));
+    }
+
+    return size;
+}
+
+/*
+ * heaps_lock_init - create the locks of the heaps
+ */
+static void heaps_lock_init(void)
+{
+    int i;
+
+    for (i = 0; i < MAX_NODES; i++)
+    {
+        pthread_mutex_init(&heaps[i].lock, NULL);
+    }
+}
+
+/*
+ * heap_acquire - lock heap h and make it the one the heap_xxx functions work on, then free the blocks that other
+ *                nodes sent back to it. Returns h.
+ */
+static heap_t *heap_acquire(heap_t *h)
+{
+    void *block;
+    void *next;
+
+    pthread_mutex_lock(&h->lock);
+    heap = h;
+
+    //we hold the lock, so we are the one consumer of the queue and can take all of it at once
+    if (__atomic_load_n(&h->remote, __ATOMIC_RELAXED) != NULL)
+    {
+        for (block = __atomic_exchange_n(&h->remote, NULL, __ATOMIC_ACQUIRE); block != NULL; block = next)
+        {
+            next = TC_NEXT(block);
+            heap_free(block);
+        }
+    }
+
+    return h;
+}
+
+/*
+ * heap_release - unlock the heap heap_acquire took
+ */
+static void heap_release(void)
+{
+    pthread_mutex_unlock(&heap->lock);
+}
+
+/*
+ * heap_of - returns the heap a block is in, NULL for a mapped block (or NULL). Every heap starts at its arena and
+ *           is at most MAX_HEAP bytes big.
+ */
+static heap_t *heap_of(void *ptr)
+{
+    int i;
+
+    for (i = 0; i < num_heaps; i++)
+    {
+        if ((size_t)((char *)ptr - heaps[i].heap_base) < MAX_HEAP)
+        {
+            return &heaps[i];
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * home_heap - returns the heap of the node the calling thread runs on. With more heaps than the machine has nodes
+ *             the threads are dealt out over the heaps in the order they first allocate, so that remote frees can be
+ *             tried on any machine.
+ */
+static heap_t *home_heap(void)
+{
+    unsigned int cpu;
+    unsigned int node;
+
+    if (num_heaps == 1)
+    {
+        return &heaps[0];
+    }
+
+    if (num_heaps > mem_num_nodes())
+    {
+        return &heaps[__atomic_fetch_add(&next_home, 1, __ATOMIC_RELAXED) % num_heaps];
+    }
+
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) < 0)
+    {
+        node = 0;
+    }
+
+    return &heaps[node % num_heaps];
+}
+
+/*
+ * remote_free - send a block back to the heap of another node. The heap's queue is a lock free stack that any
+ *               thread pushes on and the holder of the heap's lock empties, the link is kept in the payload.
+ */
+static void remote_free(heap_t *h, void *ptr)
+{
+    void *head = __atomic_load_n(&h->remote, __ATOMIC_RELAXED);
+
+    do
+    {
+        TC_NEXT(ptr) = head;
+    }
+    while (!__atomic_compare_exchange_n(&h->remote, &head, ptr, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * heaps_wanted - returns how many heaps mm_init sets up, one per NUMA node of the machine or MM_NODES from the
+ *                environment to simulate more nodes than there are
+ */
+static int heaps_wanted(void)
+{
+    char *env = getenv("MM_NODES");
+    int n = (env != NULL) ? atoi(env) : mem_num_nodes();
+
+    return MAX(1, MIN(n, MAX_NODES));
+}
+#endif
+
+/*
+ * heap_init - should find the start of the heap and reserve some initial space.
+ */
+static int heap_init(void)
+{
+    char *heap_start;
+
+    PRINT_FUNC;
+
+    heap_start = mem_arena_sbrk(heap->arena, 4 * WSIZE); //increment the break pointer by two double words
+
+    if (heap_start == (void *) - 1)
+    {
+        return -1; //No more space for heap;
+    }
+
+    heap->heap_base = heap_start;
+                                                                            //                      -----------
+    PUT(heap_start, 0);                                                     // padding              | padding |
+                                                                            //                      |---------|
+    PUT(heap_start + WSIZE, PACK(OVERHEAD, PREV_ALLOC | 1));                // prolog header        |   PH    |
+                                                                            //                      |---------|
+    PUT(heap_start + 2 * WSIZE, PACK(OVERHEAD, 1));                         // prolog footer        |   PF    |
+                                                                            //                      |---------|
+    PUT(heap_start + 3 * WSIZE, PACK(0, PREV_ALLOC | 1));                   // epilog header        |   EH    |
+                                                                            //                      -----------
+    heap_start += OVERHEAD;   //the prologue payload, the first block's payload is REQSIZE aligned
+
+    //all size classes start out empty
+    memset(heap->free_lists, 0, sizeof(heap->free_lists));
+    memset(heap->bin_map, 0, sizeof(heap->bin_map));
+    heap->class_map = 0;
+    heap->free_tree = NULL;
+    memset(heap->fast_lists, 0, sizeof(heap->fast_lists));
+    heap->fast_bytes = 0;
+    heap->dirty_bytes = 0;
+
+    //no runs yet
+    memset(heap->slab_runs, 0, sizeof(heap->slab_runs));
+    memset(heap->run_map, 0, sizeof(heap->run_map));
+
+    //on a huge page heap the brk is kept on huge page boundaries, so that no huge page is left half used
+    heap->chunk_size = MAX(CHUNKSIZE, mem_arena_pagesize(heap->arena));
+
+    //initilize some starting free space
+    heap_start = new_free_block(extension(CHUNKSIZE) / WSIZE);
+
+    //no more space available, new_free_block turns the (void *)-1 of mem_arena_sbrk into NULL
+    if (heap_start == NULL)   
+    {
+        return -1;
+    }
+
+    if (VERBOSED)
+    {
+        printf("\n");
+        printf("First free block: %p\n", heap_start);
+    }
+
+    return 0;
+}
+
+/*
+ * new_free_block - gets amount of words as input, increments brk pointer by needed bytes for requested word(s).
+ *                  constructs the new free block with size tags, next and prev pointers and adjusts the epilog
+ *                  footer.
+ */
+static void *new_free_block(size_t words)
+{
+    PRINT_FUNC;
+
+    char *new_block;   //pointer to the new free/clean block
+    size_t bytes;     //the number of bytes needed for the amount of words
+
+    if (words * WSIZE < MIN_BLOCK)
+    {
+        return NULL; //not enough space for next and prev pointers
+    }
+
+    bytes = ALIGN(words * WSIZE);    //need to keep the alignment
+
+    new_block = mem_arena_sbrk(heap->arena, bytes);  //increment the brk pointer to get more space
+
+    if (new_block == (void *) - 1)
+    {
+        return NULL;    //something went terribly wrong
+    }
+
+    //the header takes the place of the old epilog header, which knows if the last block is allocated
+    PUT(HDRP(new_block), PACK(bytes, GET_PREV_ALLOC(HDRP(new_block))));   //adding header size boundary tag
+    PUT(FTRP(new_block), PACK(bytes, 0));   //adding footer sixe boundary tag
+
+    //adjusting the epilog header
+    PUT(HDRP(NEXT_BLKP(new_block)), PACK(0, 1));     
+
+    //insert new free block to our list
+    mm_insert(new_block);
+
+    //mm_checkheap(verbose);
+
+    return coalesce(new_block);
+
+}
+/*
+ * extension - the number of bytes to grow the heap by to get a free block of size bytes, at least CHUNKSIZE. If
+ *             chunk_size is bigger the new brk is rounded up to a multiple of it.
+ */
+static size_t extension(size_t size)
+{
+    size_t brk;
+
+    if (heap->chunk_size <= CHUNKSIZE)
+    {
+        return MAX(size, CHUNKSIZE);
+    }
+
+    brk = (size_t)mem_arena_hi(heap->arena) + 1;
+    return ((brk + size + heap->chunk_size - 1) & ~(heap->chunk_size - 1)) - brk;
+}
+
+/*
+ * heap_malloc - find a free block that fits our size so that it is a modulo 0 + overhead of 8 bytes
+ *               if no space is found we increment mem_sbrk pointer for our new memory
+ */
+static void *heap_malloc(size_t size)
+{
+    PRINT_FUNC;
+
+    size_t adjsize;
+    char *allocspacePtr;
+    size_t extend_size;
+
+    /* Base case: 0 */
+    if (size <= 0)
+    {
+        return NULL;
+    }
+
+    //small requests are served from runs
+    if (size <= SLAB_MAX)
+    {
+        return slab_malloc(size);
+    }
+
+    //and big requests from regions of their own
+    if (size >= MMAP_THRESHOLD)
+    {
+        return map_malloc(size);
+    }
+
+    //Must make our size a modulo 0 + the header, big enough to hold a free block later
+    if (size <= MIN_BLOCK - WSIZE)
+    {
+        adjsize = MIN_BLOCK;
+    }
+    else
+    {
+        adjsize = REQSIZE * ((size + (WSIZE) + (REQSIZE - 1)) / REQSIZE);
+    }
+
+    //a quick list block of the exact size is taken back as it is, it is still marked allocated
+    if (MM_DEFERRED && adjsize <= FAST_MAX && heap->fast_lists[adjsize / REQSIZE] != NULL)
+    {
+        allocspacePtr = heap->fast_lists[adjsize / REQSIZE];
+        heap->fast_lists[adjsize / REQSIZE] = GET_PTR(NEXT_PTR(allocspacePtr));
+        heap->fast_bytes -= adjsize;
+        return allocspacePtr;
+    }
+
+    //scan for free space
+    allocspacePtr = scan_for_free(adjsize);
+
+    //on a miss the quick lists are coalesced and we look again before the heap grows
+    if (MM_DEFERRED && allocspacePtr == NULL && heap->fast_bytes > 0)
+    {
+        fast_coalesce();
+        allocspacePtr = scan_for_free(adjsize);
+    }
+
+    if (VERBOSED)
+    {
+        printf("AllocspacePtr gave: %p\n", allocspacePtr);
+    }
+
+    if (allocspacePtr != NULL)
+    {
+        //found free space that fits the adjusted size
+        place(allocspacePtr, adjsize);
+        return allocspacePtr;
+    }
+
+    extend_size = extension(adjsize);
+    
+    //we just allocate more space
+    allocspacePtr = new_free_block(extend_size / WSIZE);
+
+    if (allocspacePtr == NULL)
+    {
+        return NULL;
+    }
+
+    //place block in heap
+    place(allocspacePtr, adjsize);
+
+    //mm_checkheap(verbose);
+
+    return allocspacePtr;
+}
+
+/*
+ * place - place block of size adjSize at the start of pointer allocPtr
+ */
+static void place(void *alloc_ptr, size_t size_needed)
+{
+    PRINT_FUNC;
+
+    //fetch the size of the block given to us
+    size_t block_size = GET_SIZE(HDRP(alloc_ptr));      
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(alloc_ptr));
+
+    size_t block_remainder = block_size - size_needed;
+
+    //check if reallocating
+    if(!GET_ALLOC(HDRP(alloc_ptr)))
+    {
+        //delete block from our free list
+        mm_delete(alloc_ptr);
+    }
+
+    if (block_remainder >= MIN_BLOCK)
+    {
+        //split block in two
+        PUT(HDRP(alloc_ptr), PACK(size_needed, prev_alloc | 1));
+
+        //We have space for a new free block
+        alloc_ptr = NEXT_BLKP(alloc_ptr);
+        PUT(HDRP(alloc_ptr), PACK(block_remainder, PREV_ALLOC));
+        PUT(FTRP(alloc_ptr), PACK(block_remainder, 0));
+        CLEAR_PREV_ALLOC(HDRP(NEXT_BLKP(alloc_ptr)));
+        
+        //insert new block to the start of our free list, when shrinking a block the next block might be free
+        mm_insert(alloc_ptr);
+        coalesce(alloc_ptr);
+        
+    }
+    else
+    {
+        //use the whole block
+        PUT(HDRP(alloc_ptr), PACK(block_size, prev_alloc | 1));
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(alloc_ptr)));
+    }
+}
+/*
+ * heap_malloc_batch - allocate n blocks of size bytes. Small requests take whole free slot lists of runs, the
+ *                     others are carved next to each other out of as few free blocks as possible, so the size is
+ *                     rounded and the free lists are searched and updated once per free block instead of per block.
+ */
+static int heap_malloc_batch(size_t size, void **ptrs, int n)
+{
+    PRINT_FUNC;
+
+    size_t adjsize;
+    size_t extend_size;
+    char *block;
+    int got = 0;
+
+    if (size <= 0)
+    {
+        return 0;
+    }
+
+    if (size <= SLAB_MAX)
+    {
+        return slab_malloc_batch(size, ptrs, n);
+    }
+
+    if (size >= MMAP_THRESHOLD)
+    {
+        while (got < n && (ptrs[got] = map_malloc(size)) != NULL)
+        {
+            got++;
+        }
+        return got;
+    }
+
+    if (size <= MIN_BLOCK - WSIZE)
+    {
+        adjsize = MIN_BLOCK;
+    }
+    else
+    {
+        adjsize = REQSIZE * ((size + (WSIZE) + (REQSIZE - 1)) / REQSIZE);
+    }
+
+    //quick list blocks of the exact size go first, they are still marked allocated
+    while (MM_DEFERRED && got < n && adjsize <= FAST_MAX && heap->fast_lists[adjsize / REQSIZE] != NULL)
+    {
+        ptrs[got] = heap->fast_lists[adjsize / REQSIZE];
+        heap->fast_lists[adjsize / REQSIZE] = GET_PTR(NEXT_PTR(ptrs[got]));
+        heap->fast_bytes -= adjsize;
+        got++;
+    }
+
+    while (got < n)
+    {
+        //a free block that holds all that is left, else any block that holds one of them
+        if ((block = scan_for_free(adjsize * (n - got))) == NULL && (block = scan_for_free(adjsize)) == NULL)
+        {
+            if (MM_DEFERRED && heap->fast_bytes > 0)
+            {
+                fast_coalesce();
+                continue;
+            }
+
+            //grow the heap by all that is left, or by what one block needs if that does not fit
+            extend_size = extension(adjsize * (n - got));
+            if ((block = new_free_block(extend_size / WSIZE)) == NULL &&
+                (extend_size == extension(adjsize) ||
+                 (block = new_free_block(extension(adjsize) / WSIZE)) == NULL))
+            {
+                break;
+            }
+        }
+
+        got += carve(block, adjsize, n - got, ptrs + got);
+    }
+
+    return got;
+}
+
+/*
+ * carve - split up to n allocated blocks of adjsize bytes off the start of a free block, the last one takes the
+ *         rest of the block if it is too small to be free on its own. Returns the number of blocks.
+ */
+static int carve(char *block, size_t adjsize, int n, void **ptrs)
+{
+    PRINT_FUNC;
+
+    size_t block_size = GET_SIZE(HDRP(block));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(block));
+    int count = MIN((size_t)n, block_size / adjsize);
+    size_t rest = block_size - count * adjsize;
+    int i;
+
+    mm_delete(block);
+
+    for (i = 0; i < count; i++)
+    {
+        size_t size = adjsize;
+
+        if (i == count - 1 && rest < MIN_BLOCK)
+        {
+            size += rest;
+            rest = 0;
+        }
+
+        PUT(HDRP(block), PACK(size, prev_alloc | 1));
+        prev_alloc = PREV_ALLOC;
+        ptrs[i] = block;
+        block += size;
+    }
+
+    if (rest > 0)
+    {
+        //the block behind a free block is allocated and already knows its previous block is free
+        PUT(HDRP(block), PACK(rest, PREV_ALLOC));
+        PUT(FTRP(block), PACK(rest, 0));
+        mm_insert(block);
+    }
+    else
+    {
+        SET_PREV_ALLOC(HDRP(block));
+    }
+
+    return count;
+}
+
+/*
+ * size_bin - returns the index of the segregated free list that holds blocks of the given size.
+ *            Class i holds blocks of size [2^(i + MIN_CLASS), 2^(i + MIN_CLASS + 1)) and the bin inside
+ *            the class is picked by the SL_BITS bits that follow the most significant bit of the size.
+ */
+static int size_bin(size_t size)
+{
+    int class = 31 - __builtin_clz((unsigned int)size) - MIN_CLASS;
+
+    if (class >= NUM_CLASSES)           //everything bigger goes into the last bin
+    {
+        return BIN(NUM_CLASSES - 1, SL_COUNT - 1);
+    }
+
+    return BIN(class, (size >> (class + MIN_CLASS - SL_BITS)) & (SL_COUNT - 1));
+}
+
+/*
+ * mm_delete - deleting a free block from the free list of its size class
+ */
+void mm_delete(void *block)
+{
+
+    PRINT_FUNC;
+    char *next;
+    char *prev;
+    int bin = size_bin(GET_SIZE(HDRP(block)));
+
+    if (MM_BESTFIT && GET_SIZE(HDRP(block)) >= TREE_MIN)
+    {
+        tree_delete(block);
+        return;
+    }
+
+    next = GET_PTR(NEXT_PTR(block));
+    prev = GET_PTR(PREV_PTR(block));
+
+    if (next == NULL && prev != NULL)           //Case 0: At the end of a list
+    {
+        PUT_PTR(NEXT_PTR(prev), next);
+    }
+    else if (prev == NULL && next != NULL)      //Case 1: At the start of the list
+    {
+        PUT_PTR(PREV_PTR(next), prev);
+        heap->free_lists[bin] = next;
+    }
+    else if (prev == NULL && next == NULL)      //Case 2: Only block left in list
+    {
+        heap->free_lists[bin] = NULL;
+
+        //the bin is empty now, and so is the class if this was its last non-empty bin
+        heap->bin_map[bin / SL_COUNT] &= ~(1u << (bin % SL_COUNT));
+        if (heap->bin_map[bin / SL_COUNT] == 0)
+        {
+            heap->class_map &= ~(1u << (bin / SL_COUNT));
+        }
+    }
+    else if (prev != NULL && next != NULL)      //Case 3: Somewhere in the middle of the list
+    {
+        PUT_PTR(NEXT_PTR(prev), next);
+        PUT_PTR(PREV_PTR(next), prev);
+    }
+}
+/*
+ * mm_insert - inserting new free block at the start of the free list of its bin.
+ */
+void mm_insert(void *block)
+{
+
+    PRINT_FUNC;
+    int bin = size_bin(GET_SIZE(HDRP(block)));
+
+    if (MM_BESTFIT && GET_SIZE(HDRP(block)) >= TREE_MIN)
+    {
+        heap->free_tree = tree_insert(heap->free_tree, block);
+        return;
+    }
+
+    PUT_PTR(PREV_PTR(block), NULL);
+
+    if (heap->free_lists[bin] == NULL)            //case 0: Inserting in an empty list
+    {
+        PUT_PTR(NEXT_PTR(block), NULL);
+        heap->free_lists[bin] = block;
+
+        //mark the bin and its class as non-empty
+        heap->bin_map[bin / SL_COUNT] |= 1u << (bin % SL_COUNT);
+        heap->class_map |= 1u << (bin / SL_COUNT);
+    }
+    else                                    //case 1: Inserting in a non empty list
+    {
+        PUT_PTR(PREV_PTR(heap->free_lists[bin]), block);
+        PUT_PTR(NEXT_PTR(block), heap->free_lists[bin]);
+        heap->free_lists[bin] = block;
+    }
+
+}
+
+/*
+ * TREE_BEFORE - true if free tree block a comes before block b, the tree is ordered by size and then by address
+ */
+#define TREE_BEFORE(a, b) (GET_SIZE(HDRP(a)) < GET_SIZE(HDRP(b)) || \
+                           (GET_SIZE(HDRP(a)) == GET_SIZE(HDRP(b)) && (char *)(a) < (char *)(b)))
+
+/*
+ * tree_insert - inserts a block into the subtree at root and returns the new root of the subtree, the block is
+ *               rotated up as long as its priority is higher than the one of its parent
+ */
+static char *tree_insert(char *root, char *block)
+{
+    char *child;
+
+    if (root == NULL)
+    {
+        PUT_PTR(TREE_LEFT(block), NULL);
+        PUT_PTR(TREE_RIGHT(block), NULL);
+        return block;
+    }
+
+    if (TREE_BEFORE(block, root))
+    {
+        child = tree_insert(GET_PTR(TREE_LEFT(root)), block);
+        PUT_PTR(TREE_LEFT(root), child);
+
+        if (TREE_PRIO(child) > TREE_PRIO(root))
+        {
+            PUT_PTR(TREE_LEFT(root), GET_PTR(TREE_RIGHT(child)));
+            PUT_PTR(TREE_RIGHT(child), root);
+            return child;
+        }
+    }
+    else
+    {
+        child = tree_insert(GET_PTR(TREE_RIGHT(root)), block);
+        PUT_PTR(TREE_RIGHT(root), child);
+
+        if (TREE_PRIO(child) > TREE_PRIO(root))
+        {
+            PUT_PTR(TREE_RIGHT(root), GET_PTR(TREE_LEFT(child)));
+            PUT_PTR(TREE_LEFT(child), root);
+            return child;
+        }
+    }
+
+    return root;
+}
+
+/*
+ * tree_delete - removes a block from the tree by rotating it down until it has at most one child, which then
+ *               takes its place
+ */
+static void tree_delete(char *block)
+{
+    char *parent = NULL;
+    char *curr = heap->free_tree;
+    char *left, *right, *child;
+
+    //find the parent of the block, we have no pointer to it
+    while (curr != block)
+    {
+        parent = curr;
+        curr = TREE_BEFORE(block, curr) ? GET_PTR(TREE_LEFT(curr)) : GET_PTR(TREE_RIGHT(curr));
+    }
+
+    left = GET_PTR(TREE_LEFT(block));
+    right = GET_PTR(TREE_RIGHT(block));
+
+    while (left != NULL && right != NULL)
+    {
+        //the child with the higher priority moves up
+        if (TREE_PRIO(left) > TREE_PRIO(right))
+        {
+            child = left;
+            PUT_PTR(TREE_LEFT(block), GET_PTR(TREE_RIGHT(child)));
+            PUT_PTR(TREE_RIGHT(child), block);
+            left = GET_PTR(TREE_LEFT(block));
+        }
+        else
+        {
+            child = right;
+            PUT_PTR(TREE_RIGHT(block), GET_PTR(TREE_LEFT(child)));
+            PUT_PTR(TREE_LEFT(child), block);
+            right = GET_PTR(TREE_RIGHT(block));
+        }
+
+        tree_replace(parent, block, child);
+        parent = child;
+    }
+
+    tree_replace(parent, block, left != NULL ? left : right);
+}
+
+/*
+ * tree_replace - makes new take the place of old as a child of parent, or as the root if parent is NULL
+ */
+static void tree_replace(char *parent, char *old, char *new)
+{
+    if (parent == NULL)
+    {
+        heap->free_tree = new;
+    }
+    else if (GET_PTR(TREE_LEFT(parent)) == old)
+    {
+        PUT_PTR(TREE_LEFT(parent), new);
+    }
+    else
+    {
+        PUT_PTR(TREE_RIGHT(parent), new);
+    }
+}
+
+/*
+ * tree_best - returns the smallest (and then lowest) free tree block of at least size bytes, or NULL if none fits
+ */
+static char *tree_best(size_t size)
+{
+    char *curr = heap->free_tree;
+    char *best = NULL;
+
+    while (curr != NULL)
+    {
+        if (GET_SIZE(HDRP(curr)) >= size)
+        {
+            best = curr;
+            curr = GET_PTR(TREE_LEFT(curr));
+        }
+        else
+        {
+            curr = GET_PTR(TREE_RIGHT(curr));
+        }
+    }
+
+    return best;
+}
+/*
+ * heap_free - Freeing a slot back to its run, or a block back to the free lists.
+ */
+static void heap_free(void *block)
+{
+    PRINT_FUNC;
+
+    if (RUN_INDEX(block) < RUN_MAPSIZE && heap->run_map[RUN_INDEX(block)])
+    {
+        slab_free(block);
+        return;
+    }
+
+    //only a block that is not a slot has a header to look at
+    if (GET_MAPPED(HDRP(block)))
+    {
+        map_free(block);
+        return;
+    }
+
+    if (MM_DEFERRED && GET_SIZE(HDRP(block)) <= FAST_MAX)
+    {
+        fast_free(block);
+        return;
+    }
+
+    free_block(block);
+}
+
+/*
+ * heap_free_sized - heap_free for a block of a known size. Between SLAB_MAX and MMAP_THRESHOLD it can only be a
+ *                   boundary tagged block of the heap, so the run map and the MAPPED bit are not looked at.
+ */
+static void heap_free_sized(void *block, size_t size)
+{
+    PRINT_FUNC;
+
+    if (size <= SLAB_MAX || size >= MMAP_THRESHOLD)
+    {
+        heap_free(block);
+        return;
+    }
+
+    //the block is at least a header bigger than the size, so a big size skips the header read of the quick list
+    //test. Only that test is skipped, free_block still reads the header and the neighbours' to coalesce
+    if (MM_DEFERRED && size + WSIZE <= FAST_MAX && GET_SIZE(HDRP(block)) <= FAST_MAX)
+    {
+        fast_free(block);
+        return;
+    }
+
+    free_block(block);
+}
+
+/*
+ * heap_free_batch - free n blocks. They are sorted by address first, and every stretch of blocks that lie next to
+ *                   each other in the heap is freed as one block, so it is coalesced and put on a free list once.
+ */
+static void heap_free_batch(void **ptrs, int n)
+{
+    PRINT_FUNC;
+
+    char *first;
+    char *last;
+    size_t size;
+    int i;
+    int j;
+
+    qsort(ptrs, n, sizeof(void *), ptr_cmp);
+
+    for (i = 0; i < n; i = j)
+    {
+        first = ptrs[i];
+        j = i + 1;
+
+        if ((RUN_INDEX(first) < RUN_MAPSIZE && heap->run_map[RUN_INDEX(first)]) || GET_MAPPED(HDRP(first)))
+        {
+            heap_free(first);
+            continue;
+        }
+
+        //find the stretch of boundary tagged blocks that starts with first
+        last = first;
+        size = GET_SIZE(HDRP(first));
+        while (j < n && ptrs[j] == NEXT_BLKP(last) &&
+               !(RUN_INDEX(ptrs[j]) < RUN_MAPSIZE && heap->run_map[RUN_INDEX(ptrs[j])]))
+        {
+            last = ptrs[j++];
+            size += GET_SIZE(HDRP(last));
+        }
+
+        if (last == first)
+        {
+            heap_free(first);
+            continue;
+        }
+
+        //one allocated block that covers the whole stretch
+        PUT(HDRP(first), PACK(size, GET_PREV_ALLOC(HDRP(first)) | 1));
+        free_block(first);
+    }
+}
+
+/*
+ * ptr_cmp - orders block pointers by address for qsort
+ */
+static int ptr_cmp(const void *a, const void *b)
+{
+    char *x = *(char * const *)a;
+    char *y = *(char * const *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * fast_free - put a block on the quick list for its size without coalescing it, the header and the next block
+ *             still say it is allocated. The quick lists are coalesced once they hold FAST_BUDGET bytes.
+ */
+static void fast_free(void *block)
+{
+    PRINT_FUNC;
+
+    size_t size = GET_SIZE(HDRP(block));
+
+    PUT_PTR(NEXT_PTR(block), heap->fast_lists[size / REQSIZE]);
+    heap->fast_lists[size / REQSIZE] = block;
+    heap->fast_bytes += size;
+
+    if (heap->fast_bytes >= FAST_BUDGET)
+    {
+        fast_coalesce();
+    }
+}
+
+/*
+ * fast_coalesce - free every block on the quick lists for real, coalescing it with its free neighbours.
+ */
+static void fast_coalesce(void)
+{
+    PRINT_FUNC;
+
+    char *block;
+    int i;
+
+    for (i = 0; i < FAST_LISTS; i++)
+    {
+        while ((block = heap->fast_lists[i]) != NULL)
+        {
+            heap->fast_lists[i] = GET_PTR(NEXT_PTR(block));
+            free_block(block);
+        }
+    }
+
+    heap->fast_bytes = 0;
+}
+
+/*
+ * free_block - Freeing a boundary tagged block and coalesce it with its free neighbours. A free block of at least
+ *              RELEASE_THRESHOLD bytes has its pages released, so only the span that was not free yet, or was free
+ *              in a block too small to be released, is released when the block grows by coalescing. A span below
+ *              RELEASE_BUDGET is only counted, the whole block it went into is released again once the spans
+ *              counted add up to it, so that small frees next to a released block don't each cost a madvise.
+ */
+static void free_block(void *block)
+{
+    PRINT_FUNC;
+
+    size_t ptrSize = GET_SIZE(HDRP(block));
+    char *lo = block;
+    char *hi = (char *)block + ptrSize;
+
+    //the neighbours that are big enough had their pages released when they became free
+    if (!GET_PREV_ALLOC(HDRP(block)) && GET_SIZE(HDRP(PREV_BLKP(block))) < RELEASE_THRESHOLD)
+    {
+        lo = PREV_BLKP(block);
+    }
+
+    if (!GET_ALLOC(HDRP(NEXT_BLKP(block))) && GET_SIZE(HDRP(NEXT_BLKP(block))) < RELEASE_THRESHOLD)
+    {
+        hi = (char *)NEXT_BLKP(block) + GET_SIZE(HDRP(NEXT_BLKP(block)));
+    }
+
+    //Free the header and add a footer to the given pointer, and tell the next block we are free
+    PUT(HDRP(block), PACK(ptrSize, GET_PREV_ALLOC(HDRP(block))));
+    PUT(FTRP(block), PACK(ptrSize, 0));
+    CLEAR_PREV_ALLOC(HDRP(NEXT_BLKP(block)));
+
+    //insert block at the start of our free list
+    mm_insert(block);
+
+    //mm_checkheap(verbose);
+
+    block = coalesce(block);
+    ptrSize = GET_SIZE(HDRP(block));
+
+    if (ptrSize >= TRIM_THRESHOLD && GET_SIZE(HDRP(NEXT_BLKP(block))) == 0)
+    {
+        trim_heap(block);
+    }
+    else if (ptrSize >= RELEASE_THRESHOLD)
+    {
+        //keep the links at the start and the footer at the end of the block
+        lo = MAX(lo, (char *)block + 2 * PSIZE);
+        hi = MIN(hi, (char *)block + ptrSize - OVERHEAD);
+
+        if (hi - lo >= RELEASE_BUDGET)
+        {
+            mem_release(lo, hi - lo);
+        }
+        else if (hi > lo && (heap->dirty_bytes += hi - lo) >= RELEASE_BUDGET)
+        {
+            mem_release((char *)block + 2 * PSIZE, ptrSize - 2 * PSIZE - OVERHEAD);
+            heap->dirty_bytes = 0;
+        }
+    }
+}
+
+/*
+ * trim_heap - give the end of the free last block back to the OS by shrinking the heap, TRIM_KEEP bytes of it
+ *             are kept so that a heap that keeps growing and shrinking a bit is not trimmed every time.
+ */
+static void trim_heap(void *block)
+{
+    PRINT_FUNC;
+
+    size_t size = GET_SIZE(HDRP(block));
+
+    mm_delete(block);
+
+    if (mem_arena_sbrk(heap->arena, -(int)(size - TRIM_KEEP)) == (void *) - 1)
+    {
+        mm_insert(block);
+        return;
+    }
+
+    //the block before a free block is always allocated
+    PUT(HDRP(block), PACK(TRIM_KEEP, PREV_ALLOC));
+    PUT(FTRP(block), PACK(TRIM_KEEP, 0));
+    PUT(HDRP(NEXT_BLKP(block)), PACK(0, 1));    //the new epilog header, behind a free block
+
+    mm_insert(block);
+}
+
+/*
+ * heap_realloc - Resize a block in place whenever its neighbours or the end of the heap allow it, oldsize is the
+ *                size of the block if the caller knows it, else 0
+ */
+static void *heap_realloc(void *ptr, size_t oldsize, size_t size)
+{
+
+    /* 
+     * #1: See if new size is less then the current block size, then we cut the block in half.
+     * #2: See if next block is free, or we are the last block, then simply expand.
+     * #3: See if the previous block is free, then expand into it and move the payload once.
+     * #4: Need to copy contents to another location
      */
 
-    PRINT_FUNC;
+    PRINT_FUNC;
+
+    void *newptr;
+    size_t copySize;
+    size_t request;
+
+    if (size == 0)
+    {
+        heap_free(ptr);
+        return NULL;
+    }   
+
+    //a slot can not grow, it is kept as long as the new size fits in it. A block bigger than SLAB_MAX is no slot
+    if (oldsize <= SLAB_MAX && RUN_INDEX(ptr) < RUN_MAPSIZE && heap->run_map[RUN_INDEX(ptr)])
+    {
+        copySize = SLOT_SIZE(heap->run_map[RUN_INDEX(ptr)] - 1);
+
+        if (size <= copySize)
+        {
+            return ptr;
+        }
+
+        if ((newptr = heap_malloc(size)) == NULL)
+        {
+            return NULL;
+        }
+
+        memcpy(newptr, ptr, copySize);
+        slab_free(ptr);
+        return newptr;
+    }
+
+    if (GET_MAPPED(HDRP(ptr)))
+    {
+        return map_realloc(ptr, size);
+    }
+
+    copySize = GET_SIZE(HDRP(ptr));
+    request = size;
+
+    if (size <= MIN_BLOCK - WSIZE)
+    {
+        size = MIN_BLOCK;
+    }
+    else
+    {
+        size = REQSIZE * ((size + (WSIZE) + (REQSIZE - 1)) / REQSIZE);
+    }
+
+    if (size <= copySize)
+    {
+        place(ptr, size);
+        return ptr;
+    }
+
+    char *next = NEXT_BLKP(ptr);
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(ptr));
+    size_t avail = copySize;        //what we can have without moving the payload
+    size_t left_size = 0;
+    int at_tail;
+
+    //a free right neighbour is absorbed, the epilogue has size 0 so it never is
+    if (!GET_ALLOC(HDRP(next)))
+    {
+        avail += GET_SIZE(HDRP(next));
+        next = NEXT_BLKP(next);
+    }
+    at_tail = (GET_SIZE(HDRP(next)) == 0);
+
+    //a free left neighbour has a footer
+    if (!prev_alloc)
+    {
+        left_size = GET_SIZE((char *)ptr - OVERHEAD);
+    }
+
+    //grow in place (#2) over the free right neighbour, extending the heap if we are its last block. A heap that
+    //can't grow any more may still have a free block elsewhere that fits, so then the block is moved (#4)
+    if (avail >= size || (at_tail && left_size == 0 && mem_arena_sbrk(heap->arena, size - avail) != (void *) - 1))
+    {
+        if (!GET_ALLOC(HDRP(NEXT_BLKP(ptr))))
+        {
+            mm_delete(NEXT_BLKP(ptr));
+        }
+
+        if (avail < size)
+        {
+            avail = size;
+            PUT(HDRP((char *)ptr + avail), PACK(0, PREV_ALLOC | 1));   //the new epilog header
+        }
+
+        PUT(HDRP(ptr), PACK(avail, prev_alloc | 1));
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(ptr)));
+        place(ptr, size);
+        return ptr;
+    }
+
+    //grow into the free left neighbour, and into the heap if needed. The payload is moved only once. The heap is
+    //grown before anything is unlinked, if it can't grow the block is moved (#4) and stays as it is until then
+    if (left_size && (avail + left_size >= size ||
+                      (at_tail && mem_arena_sbrk(heap->arena, size - avail - left_size) != (void *) - 1)))
+    {
+        //a block we move probably grows again, so we keep what headroom (#4) we can. The last block needs none
+        if (!at_tail)
+        {
+            size = MIN(avail + left_size, size + ALIGN(size >> REALLOC_HEADROOM));
+        }
+        newptr = PREV_BLKP(ptr);
+        mm_delete(newptr);
+        if (!GET_ALLOC(HDRP(NEXT_BLKP(ptr))))
+        {
+            mm_delete(NEXT_BLKP(ptr));
+        }
+        avail += left_size;
+
+        if (avail < size)
+        {
+            avail = size;
+            PUT(HDRP((char *)newptr + avail), PACK(0, PREV_ALLOC | 1));   //the new epilog header
+        }
+
+        //the ranges overlap, and the move overwrites our own header
+        memmove(newptr, ptr, copySize - WSIZE);
+        PUT(HDRP(newptr), PACK(avail, PREV_ALLOC | 1));
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(newptr)));
+        place(newptr, size);
+        return newptr;
+    }
+
+    //find new block, a block that grows once probably grows again so we leave it some headroom (#4). The headroom
+    //never gets a request below MMAP_THRESHOLD a mapped block, mm_free_sized counts on that
+    request = (request < MMAP_THRESHOLD) ? MIN(size + ALIGN(size >> REALLOC_HEADROOM), MMAP_THRESHOLD - 1)
+                                         : size + ALIGN(size >> REALLOC_HEADROOM);
+    newptr = heap_malloc(request);
+
+    //out of memory, the block is left as it is
+    if (newptr == NULL)
+    {
+        return NULL;
+    }
+
+    //copy content to new adress, the payload is the block without its header
+    memcpy(newptr, ptr, copySize - WSIZE);
+    free_block(ptr);
+    return newptr;
+}
+
+/*
+ * map_malloc - gives a request a mapped region of its own, the payload starts MAP_HDRSIZE bytes into it
+ */
+static void *map_malloc(size_t size)
+{
+    PRINT_FUNC;
+
+    size_t page = mem_pagesize();
+    size_t region = (size + MAP_HDRSIZE + page - 1) & ~(page - 1);
+    char *block;
+
+    //the region size must fit in a header tag
+    if (region > (size_t)~0x7u || (block = mem_map(region)) == NULL)
+    {
+        return NULL;
+    }
+
+    block += MAP_HDRSIZE;
+    PUT(HDRP(block), PACK(region, MAPPED | 1));
+    return block;
+}
+
+/*
+ * map_free - unmaps the region of a mapped block
+ */
+static void map_free(void *block)
+{
+    PRINT_FUNC;
+
+    mem_unmap((char *)block - MAP_HDRSIZE);
+}
+
+/*
+ * map_realloc - resizes a mapped block with mem_remap, which does not copy the payload. A block that shrinks below
+ *               MMAP_THRESHOLD moves back into the heap.
+ */
+static void *map_realloc(void *block, size_t size)
+{
+    PRINT_FUNC;
+
+    size_t page = mem_pagesize();
+    size_t region = (size + MAP_HDRSIZE + page - 1) & ~(page - 1);
+    char *newptr;
+
+    if (size < MMAP_THRESHOLD)
+    {
+        if ((newptr = heap_malloc(size)) == NULL)
+        {
+            return NULL;
+        }
+
+        memcpy(newptr, block, size);
+        map_free(block);
+        return newptr;
+    }
+
+    //mem_remap leaves the region as it is when it fails
+    if (region > (size_t)~0x7u || (newptr = mem_remap((char *)block - MAP_HDRSIZE, region)) == NULL)
+    {
+        return NULL;
+    }
+
+    newptr += MAP_HDRSIZE;
+    PUT(HDRP(newptr), PACK(region, MAPPED | 1));
+    return newptr;
+}
+
+/*
+ * heap_memalign - allocate a block of at least size bytes whose payload address is a multiple of align. It is always
+ *                 a boundary tagged block of the heap, a slot or a mapped region only has a REQSIZE aligned payload.
+ */
+static void *heap_memalign(size_t align, size_t size)
+{
+    PRINT_FUNC;
+
+    size_t adjsize;
+
+    if (size == 0)
+    {
+        return NULL;
+    }
+
+    if (size <= MIN_BLOCK - WSIZE)
+    {
+        adjsize = MIN_BLOCK;
+    }
+    else
+    {
+        adjsize = REQSIZE * ((size + (WSIZE) + (REQSIZE - 1)) / REQSIZE);
+    }
+
+    return alloc_aligned(adjsize, align);
+}
+
+/*
+ * alloc_aligned - allocates a block of the adjusted size adjsize whose payload address is a multiple of align.
+ *                 The block that fits adjsize is taken if the aligned payload fits in it too, else we ask for a
+ *                 block big enough to hold the aligned payload wherever it starts. The slack in front of the
+ *                 payload is split off as a free block so it is not lost, and the rest behind it by place.
+ */
+static void *alloc_aligned(size_t adjsize, size_t align)
+{
+    PRINT_FUNC;
+
+    size_t reqsize = adjsize + align + MIN_BLOCK;
+    size_t block_size;
+    size_t lead;
+    char *block;
+    char *aligned = NULL;
+
+    if ((block = scan_for_free(adjsize)) != NULL)
+    {
+        aligned = aligned_payload(block, adjsize, align);
+    }
+
+    if (aligned == NULL)
+    {
+        block = scan_for_free(reqsize);
 
-    void *newptr;
-    size_t copySize;
+        //on a miss the quick lists are coalesced and we look again before the heap grows
+        if (MM_DEFERRED && block == NULL && heap->fast_bytes > 0)
+        {
+            fast_coalesce();
+            block = scan_for_free(reqsize);
+        }
 
-    copySize = GET_SIZE(HDRP(ptr));
+        if (block == NULL && (block = new_free_block(extension(reqsize) / WSIZE)) == NULL)
+        {
+            return NULL;
+        }
+
+        aligned = aligned_payload(block, adjsize, align);
+    }
 
-    // We don't have to realloc if new size == copySize
-    if (copySize == size)
+    lead = aligned - block;
+    if (lead > 0)
     {
-        return ptr;
+        block_size = GET_SIZE(HDRP(block));
+        mm_delete(block);
+
+        //the slack keeps the left neighbour, which is allocated
+        PUT(HDRP(block), PACK(lead, PREV_ALLOC));
+        PUT(FTRP(block), PACK(lead, 0));
+        mm_insert(block);
+
+        //and the rest is a free block with a free left neighbour
+        PUT(HDRP(aligned), PACK(block_size - lead, 0));
+        PUT(FTRP(aligned), PACK(block_size - lead, 0));
+        mm_insert(aligned);
     }
 
-    if (size == 0)
+    place(aligned, adjsize);
+
+    return aligned;
+}
+
+/*
+ * aligned_payload - returns the first payload address in the free block that is a multiple of align and leaves
+ *                   room for a free block in front of it, or none, if a block of adjsize fits there. Else NULL.
+ */
+static char *aligned_payload(char *block, size_t adjsize, size_t align)
+{
+    char *aligned = (char *)(((size_t)block + align - 1) & ~(align - 1));
+
+    //the slack in front must be big enough to be a free block of its own
+    while (aligned != block && (size_t)(aligned - block) < MIN_BLOCK)
     {
-        mm_free(ptr);
-        return NULL;
-    }   
+        aligned += align;
+    }
 
-    if (size <= REQSIZE)
+    if ((size_t)(aligned - block) + adjsize > GET_SIZE(HDRP(block)))
     {
-        size = REQSIZE + OVERHEAD;
+        return NULL;
     }
-    else
+
+    return aligned;
+}
+
+/*
+ * slab_malloc - hand out a free slot of the slab class of size, a new run is made if no run of the class has room.
+ */
+static void *slab_malloc(size_t size)
+{
+    PRINT_FUNC;
+
+    int class = SLAB_CLASS(size);
+    char *run = heap->slab_runs[class];
+    char *slot;
+
+    if (run == NULL && (run = new_run(class)) == NULL)
     {
-        size = REQSIZE * ((size + (OVERHEAD) + (REQSIZE - 1)) / REQSIZE);
+        return NULL;
     }
 
-    if (size < copySize)
+    //pop the first free slot
+    slot = GET_PTR(RUN_FREE(run));
+    PUT_PTR(RUN_FREE(run), GET_PTR(slot));
+    PUT(RUN_USED(run), GET(RUN_USED(run)) + 1);
+
+    //a full run has nothing to offer, take it off the list until a slot is freed
+    if (GET_PTR(RUN_FREE(run)) == NULL)
     {
-        place(ptr, size);
-        return ptr;
+        run_unlink(run, class);
     }
 
-    size_t right = GET_ALLOC(HDRP(NEXT_BLKP(ptr)));
-    size_t new_size = (GET_SIZE(HDRP(NEXT_BLKP(ptr)))) + copySize;
-    size_t right_remainder = new_size - size;
+    return slot;
+}
+
+/*
+ * slab_malloc_batch - hand out n slots of the slab class of size, each run is emptied of free slots in one go.
+ */
+static int slab_malloc_batch(size_t size, void **ptrs, int n)
+{
+    PRINT_FUNC;
+
+    int class = SLAB_CLASS(size);
+    char *run;
+    char *slot;
+    unsigned int used;
+    int got = 0;
 
-    // 1. Next block is free, 2. Size of both blocks is big enough, 3. Not the Epilog header
-    if(right == 0 && new_size > size && GET_SIZE(HDRP(NEXT_BLKP(ptr))) != 0)
+    while (got < n)
     {
-        //remainder of the block is big enough to be a free block
-        if(right_remainder >= REQSIZE + OVERHEAD)
+        if ((run = heap->slab_runs[class]) == NULL && (run = new_run(class)) == NULL)
         {
-            mm_delete(NEXT_BLKP(ptr));
-            PUT(HDRP(ptr), PACK(size, 1));
-            PUT(FTRP(ptr), PACK(size, 1));
+            break;
+        }
 
-            ptr = NEXT_BLKP(ptr);
-            PUT(HDRP(ptr), PACK(right_remainder, 0));
-            PUT(FTRP(ptr), PACK(right_remainder, 0));
-            mm_insert(ptr); 
-            return PREV_BLKP(ptr);
+        slot = GET_PTR(RUN_FREE(run));
+        used = GET(RUN_USED(run));
+        while (slot != NULL && got < n)
+        {
+            ptrs[got++] = slot;
+            slot = GET_PTR(slot);
+            used++;
         }
-        else
+        PUT_PTR(RUN_FREE(run), slot);
+        PUT(RUN_USED(run), used);
+
+        if (slot == NULL)
         {
-            //otherwise we use the whole block
-            mm_delete(NEXT_BLKP(ptr));
-            PUT(HDRP(ptr), PACK(new_size, 1));
-            PUT(FTRP(ptr), PACK(new_size, 1));
+            run_unlink(run, class);
         }
+    }
 
-        return ptr;
+    return got;
+}
+
+/*
+ * slab_free - give a slot back to its run. A run that becomes empty is given back to the free lists, unless
+ *             it is the only run of its class with free slots so we do not make and free runs over and over.
+ */
+static void slab_free(void *slot)
+{
+    PRINT_FUNC;
+
+    char *run = RUNP(slot);
+    int class = heap->run_map[RUN_INDEX(slot)] - 1;
+
+    //a full run gets back on the list of its class
+    if (GET_PTR(RUN_FREE(run)) == NULL)
+    {
+        PUT_PTR(RUN_PREV(run), NULL);
+        PUT_PTR(RUN_NEXT(run), heap->slab_runs[class]);
+        if (heap->slab_runs[class] != NULL)
+        {
+            PUT_PTR(RUN_PREV(heap->slab_runs[class]), run);
+        }
+        heap->slab_runs[class] = run;
     }
 
-    //find new block
-    newptr = mm_malloc(size);
+    //push the slot on the free slot list
+    PUT_PTR(slot, GET_PTR(RUN_FREE(run)));
+    PUT_PTR(RUN_FREE(run), slot);
+    PUT(RUN_USED(run), GET(RUN_USED(run)) - 1);
 
-    if (newptr == NULL)
+    if (GET(RUN_USED(run)) == 0 && (heap->slab_runs[class] != run || GET_PTR(RUN_NEXT(run)) != NULL))
     {
-        printf("ERROR: mm_realloc\n");
-        exit(1);
+        run_unlink(run, class);
+        heap->run_map[RUN_INDEX(run)] = 0;
+        free_block(run);
     }
+}
+
+/*
+ * new_run - make an empty run for a slab class, link all its slots into its free slot list and put it on the
+ *           list of runs of the class.
+ */
+static void *new_run(int class)
+{
+    PRINT_FUNC;
 
+    size_t slot_size = SLOT_SIZE(class);
+    char *run;
+    char *slot;
 
-    //copy content to new adress
-    memcpy(newptr, ptr, copySize);
-    mm_free(ptr);
-    return newptr;
+    //the run is a RUN_SIZE aligned block with room for the whole run in its payload
+    if ((run = alloc_aligned(RUN_SIZE + REQSIZE, RUN_SIZE)) == NULL)
+    {
+        return NULL;
+    }
+
+    heap->run_map[RUN_INDEX(run)] = class + 1;
+
+    //link the slots in address order
+    PUT_PTR(RUN_FREE(run), run + RUN_HDRSIZE);
+    for (slot = run + RUN_HDRSIZE; slot + 2 * slot_size <= run + RUN_SIZE; slot += slot_size)
+    {
+        PUT_PTR(slot, slot + slot_size);
+    }
+    PUT_PTR(slot, NULL);
+
+    PUT(RUN_USED(run), 0);
+    PUT_PTR(RUN_PREV(run), NULL);
+    PUT_PTR(RUN_NEXT(run), heap->slab_runs[class]);
+    if (heap->slab_runs[class] != NULL)
+    {
+        PUT_PTR(RUN_PREV(heap->slab_runs[class]), run);
+    }
+    heap->slab_runs[class] = run;
+
+    return run;
+}
+
+/*
+ * run_unlink - take a run off the list of runs of its slab class
+ */
+static void run_unlink(char *run, int class)
+{
+    PRINT_FUNC;
+
+    char *next = GET_PTR(RUN_NEXT(run));
+    char *prev = GET_PTR(RUN_PREV(run));
+
+    if (prev == NULL)
+    {
+        heap->slab_runs[class] = next;
+    }
+    else
+    {
+        PUT_PTR(RUN_NEXT(prev), next);
+    }
+
+    if (next != NULL)
+    {
+        PUT_PTR(RUN_PREV(next), prev);
+    }
 }
 
 /*
- * coalecse -check the two neighboring blocks for alocation, if possible we will merge these blocks together
+ * coalecse -check the two neighboring blocks for alocation, if possible we will merge these blocks together.
+ *           The block before a free block is always allocated, so the merged block always gets PREV_ALLOC.
  */
 static void *coalesce(void *middle)
 {
     PRINT_FUNC;
-    size_t left = GET_ALLOC(FTRP(PREV_BLKP(middle)));
+    size_t left = GET_PREV_ALLOC(HDRP(middle));
     size_t right = GET_ALLOC(HDRP(NEXT_BLKP(middle)));
     size_t size = GET_SIZE(HDRP(middle));
 
@@ -510,14 +2366,14 @@ static void *coalesce(void *middle)
     {
         mm_delete(NEXT_BLKP(middle));
         size += GET_SIZE(HDRP(NEXT_BLKP(middle)));
-        PUT(HDRP(middle), PACK(size, 0));
+        PUT(HDRP(middle), PACK(size, PREV_ALLOC));
         PUT(FTRP(middle), PACK(size, 0));
     }
     else if (!left && right)                            //Case 2: Left neigbor is a free block
     {
         mm_delete(PREV_BLKP(middle));
         size += GET_SIZE(HDRP(PREV_BLKP(middle)));
-        PUT(HDRP(PREV_BLKP(middle)), PACK(size, 0));
+        PUT(HDRP(PREV_BLKP(middle)), PACK(size, PREV_ALLOC));
         PUT(FTRP(middle), PACK(size, 0));
         middle = PREV_BLKP(middle);
     }
@@ -526,7 +2382,7 @@ static void *coalesce(void *middle)
         mm_delete(PREV_BLKP(middle));
         mm_delete(NEXT_BLKP(middle));
         size += GET_SIZE(HDRP(PREV_BLKP(middle))) + GET_SIZE(FTRP(NEXT_BLKP(middle)));
-        PUT(HDRP(PREV_BLKP(middle)), PACK(size, 0));
+        PUT(HDRP(PREV_BLKP(middle)), PACK(size, PREV_ALLOC));
         PUT(FTRP(NEXT_BLKP(middle)), PACK(size, 0));
         middle = PREV_BLKP(middle);
     }
@@ -537,102 +2393,364 @@ static void *coalesce(void *middle)
     return middle;
 }
 /*
- * scan_for_free - Scans the our explisit list for a block that suits the requierd size.
+ * scan_for_free - Scans the segregated lists for a block that suits the requierd size. The request is rounded up
+ *                 to the next bin unless it is the smallest size of its own, so that any block from there on
+ *                 fits: we look up the first non-empty bin in the bitmaps and take the block at its head. Only
+ *                 the last bin, which holds every bigger size, has to be walked.
  */
 static void *scan_for_free(size_t reqsize)
 {
     PRINT_FUNC;
     char *curr;
+    int bin = size_bin(reqsize);
+    int class = bin / SL_COUNT;
+    unsigned int map;
+
+    //big requests only fit blocks in the tree
+    if (MM_BESTFIT && reqsize >= TREE_MIN)
+    {
+        return tree_best(reqsize);
+    }
+
+    if (bin == NUM_BINS - 1)
+    {
+        //Start on the head of the list and run down it
+        for (curr = heap->free_lists[bin]; curr != NULL; curr = GET_PTR(NEXT_PTR(curr)))
+        {
+            //Found space fits the requierd size
+            if (reqsize <= GET_SIZE(HDRP(curr)))
+            {
+                return curr;
+            }
+        }
 
-    //Start on the head of the heap and run down it
-    for (curr = free_startp; curr != NULL; curr = (char *)GET(NEXT_PTR(curr)))
+        return MM_BESTFIT ? tree_best(reqsize) : NULL;
+    }
+
+    //the bin can hold blocks a bit smaller than the request, the next one can't
+    if (reqsize & ((1u << (class + MIN_CLASS - SL_BITS)) - 1))
+    {
+        bin++;
+        class = bin / SL_COUNT;
+    }
+
+    //first try the bins of the same class
+    map = heap->bin_map[class] & (~0u << (bin % SL_COUNT));
+
+    if (map == 0)
     {
-        //Found space fits the requierd size
-        if (reqsize <= GET_SIZE(HDRP(curr)))
+        //then the smallest non-empty bin of the first bigger class
+        map = heap->class_map & (~0u << (class + 1));
+
+        if (map == 0)
         {
-            return curr;
+            return MM_BESTFIT ? tree_best(reqsize) : NULL; // need more space, unless a tree block fits
         }
+
+        class = __builtin_ctz(map);
+        map = heap->bin_map[class];
     }
-    return NULL; // need more space
+
+    return heap->free_lists[BIN(class, __builtin_ctz(map))];
 }
 
+#if MM_DEBUG
 /*
- * mm_checkheap - Our life saving heap checker, can print out the whole heap, print the free list, check Epilog and prolog headers 
- * for coruption, see if free list next pointers are out of bounds, check for header and footer consistency and check for block
- * alignment
+ * check_size_hint - make sure a block given to mm_free_sized or mm_realloc_sized is allocated, can hold the size
+ *                   it is said to have and is the kind of block the size says, before the size is trusted.
  */
- /*
-void mm_checkheap(int verbose)
+static void check_size_hint(void *ptr, size_t size)
 {
-    PRINT_FUNC;
+    size_t usable;
+    size_t need = size;
+
+#if MM_THREADSAFE
+    heap_t *h = heap_of(ptr);
 
-    char *bp = heap_start;
+    need = tc_round(size);
+#else
+    heap_t *h = heap;
+#endif
 
-    if (verbose)
+    if (h != NULL && RUN_INDEX_IN(h, ptr) < RUN_MAPSIZE && h->run_map[RUN_INDEX_IN(h, ptr)])
+    {
+        usable = SLOT_SIZE(h->run_map[RUN_INDEX_IN(h, ptr)] - 1);
+    }
+    else if (!GET_ALLOC(HDRP(ptr)))
     {
-        if(verbose == 2)
+        printf("ERROR: %p given with size %zu is not allocated\n", ptr, size);
+        exit(1);
+    }
+    else if (GET_MAPPED(HDRP(ptr)))
+    {
+        usable = GET_SIZE(HDRP(ptr)) - MAP_HDRSIZE;
+        if (size < MMAP_THRESHOLD)
         {
-            printf("Heap (%p):\n", heap_start);
+            printf("ERROR: mapped block %p given with size %zu\n", ptr, size);
+            exit(1);
         }
-
-        if ((GET_SIZE(HDRP(heap_start)) != REQSIZE) || !GET_ALLOC(HDRP(heap_start)))
+    }
+    else
+    {
+        //the next block must know that this one is allocated
+        if (!GET_PREV_ALLOC(HDRP(NEXT_BLKP(ptr))))
         {
-            printf("Bad prologue header\n");
+            printf("ERROR: the block after %p does not know it is allocated\n", ptr);
+            exit(1);
         }
-        checkblock(heap_start);
+        usable = GET_SIZE(HDRP(ptr)) - WSIZE;
+    }
+
+    if (need > usable)
+    {
+        printf("ERROR: %p given with size %zu holds %zu bytes\n", ptr, size, usable);
+        exit(1);
+    }
+}
+#endif
+
+/*
+ * mm_checkheap - Our life saving heap checker, checks the Epilog and prolog headers for coruption, every block for
+ * alignment, header and footer consistency and its previous allocated bit, that no two free blocks are neighbours,
+ * and that the free lists and the tree hold exactly the free blocks of the heap, each one in the right place. With
+ * verbose == 2 it also prints out the whole heap and the free lists. The thread safe build checks the heap of every
+ * node.
+ */
+void mm_checkheap(int verbose)
+{
+#if MM_THREADSAFE
+    int i;
+
+    for (i = 0; i < num_heaps; i++)
+    {
+        heap_acquire(&heaps[i]);
+        checkheap(verbose);
+        heap_release();
     }
+#else
+    checkheap(verbose);
+#endif
+}
+
+/*
+ * checkheap - helperfunction for mm_checkheap(), checks the heap the heap_xxx functions work on
+ */
+static void checkheap(int verbose)
+{
+    PRINT_FUNC;
+
+    char *heap_start = heap->heap_base + OVERHEAD;    //the prolog block
+    char *bp;
+    char *curr;
+    size_t prev_alloc = PREV_ALLOC;
+    int free_blocks = 0;
+    int listed_blocks = 0;
+    int bin;
 
     if (verbose == 2)
     {
-        for (bp = heap_start; GET_SIZE(HDRP(bp)) > 0; bp = (char *)NEXT_BLKP(bp))
+        printf("Heap (%p):\n", heap_start);
+    }
+
+    if ((GET_SIZE(HDRP(heap_start)) != OVERHEAD) || !GET_ALLOC(HDRP(heap_start)))
+    {
+        printf("Bad prologue header\n");
+    }
+
+    //the prologue payload is not REQSIZE aligned, the blocks after it are
+    for (bp = NEXT_BLKP(heap_start); GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp))
+    {
+        if (verbose == 2)
         {
             printblock(bp);
-            checkblock(bp);
+        }
+        checkblock(bp);
+
+        if (GET_PREV_ALLOC(HDRP(bp)) != prev_alloc)
+        {
+            printf("Error: %p has a wrong previous allocated bit\n", bp);
         }
 
+        if (!GET_ALLOC(HDRP(bp)))
+        {
+            if (!prev_alloc)
+            {
+                printf("Error: %p and the block before it are both free\n", bp);
+            }
+            free_blocks++;
+        }
+        prev_alloc = GET_ALLOC(HDRP(bp)) ? PREV_ALLOC : 0;
+    }
+
+    if (verbose == 2)
+    {
         printblock(bp);
-        char *curr;
+    }
+
+    if ((GET_SIZE(HDRP(bp)) != 0) || !(GET_ALLOC(HDRP(bp))) || GET_PREV_ALLOC(HDRP(bp)) != prev_alloc)
+    {
+        printf("Bad epilogue header\n");
+    }
 
-        for (curr = free_startp; curr != NULL; curr = (char *)GET(NEXT_PTR(curr)))
+    if (bp != (char *)mem_arena_hi(heap->arena) + 1)
+    {
+        printf("Error: epilogue (%p) is not at the end of the heap\n", bp);
+    }
+
+    for (bin = 0; bin < NUM_BINS; bin++)
+    {
+        if (verbose == 2)
         {
+            printf("bin %d: ", bin);
+        }
 
-            if (curr < (char *)mem_heap_lo() || curr > (char *)mem_heap_hi())
+        for (curr = heap->free_lists[bin]; curr != NULL; curr = GET_PTR(NEXT_PTR(curr)))
+        {
+            if (curr < heap_start || curr > (char *)mem_arena_hi(heap->arena))
             {
                 printf("free list adress (%p) out of bounds \n", curr);
                 break;
             }
-            else
+
+            if (verbose == 2)
             {
                 printf("(%p)->", curr);
             }
+
+            if (GET_ALLOC(HDRP(curr)) || size_bin(GET_SIZE(HDRP(curr))) != bin)
+            {
+                printf("Error: %p does not belong in bin %d\n", curr, bin);
+            }
+
+            if (GET_PTR(NEXT_PTR(curr)) != NULL && GET_PTR(PREV_PTR(GET_PTR(NEXT_PTR(curr)))) != curr)
+            {
+                printf("Error: the block after %p in bin %d does not link back to it\n", curr, bin);
+            }
+            listed_blocks++;
+        }
+
+        if (verbose == 2)
+        {
+            printf("\n");
         }
-        printf("\n");
 
-        if ((GET_SIZE(HDRP(bp)) != 0) || !(GET_ALLOC(HDRP(bp))))
+        if (((heap->bin_map[bin / SL_COUNT] >> (bin % SL_COUNT)) & 1) != (heap->free_lists[bin] != NULL) ||
+            ((heap->class_map >> (bin / SL_COUNT)) & 1) != (heap->bin_map[bin / SL_COUNT] != 0))
         {
-            printf("Bad epilogue header\n");
+            printf("Error: the bitmaps are wrong for bin %d\n", bin);
         }
     }
 
+    listed_blocks += checktree(heap->free_tree);
+
+    if (listed_blocks != free_blocks)
+    {
+        printf("Error: the heap has %d free blocks but the free lists have %d\n", free_blocks, listed_blocks);
+    }
 }
-*/
 
 /*
- * printblock - helperfunction for checkheap()
+ * mm_heapstats - walks the heap like mm_checkheap and sums up its free blocks, the free slots of its runs and the
+ *                blocks on its quick lists into stats. The thread safe build adds up the heaps of all nodes, the
+ *                blocks in the threads' caches count as allocated.
  */
- /*
-static void printblock(void *bp)
+void mm_heapstats(heapstats_t *stats)
+{
+#if MM_THREADSAFE
+    int i;
+
+    memset(stats, 0, sizeof(*stats));
+    for (i = 0; i < num_heaps; i++)
+    {
+        heap_acquire(&heaps[i]);
+        heapstats(stats);
+        heap_release();
+    }
+#else
+    memset(stats, 0, sizeof(*stats));
+    heapstats(stats);
+#endif
+}
+
+/*
+ * heapstats - helperfunction for mm_heapstats(), adds the heap the heap_xxx functions work on to stats
+ */
+static void heapstats(heapstats_t *stats)
+{
+    char *bp;
+    char *run;
+    size_t size;
+    int class;
+
+    stats->heap_bytes += mem_arena_heapsize(heap->arena);
+    stats->cached_bytes += heap->fast_bytes;
+
+    for (bp = NEXT_BLKP(heap->heap_base + OVERHEAD); (size = GET_SIZE(HDRP(bp))) > 0; bp = NEXT_BLKP(bp))
+    {
+        if (GET_ALLOC(HDRP(bp)))
+        {
+            continue;
+        }
+
+        //class i holds the blocks of 16 << i up to 32 << i bytes
+        for (class = 0; class < HEAPSTATS_CLASSES - 1 && size >= (size_t)32 << class; class++)
+            ;
+        stats->free_hist[class]++;
+        stats->free_blocks++;
+        stats->free_bytes += size;
+        stats->largest_free = MAX(stats->largest_free, size);
+    }
+
+    //only the runs on the lists have free slots
+    for (class = 0; class < SLAB_CLASSES; class++)
+    {
+        for (run = heap->slab_runs[class]; run != NULL; run = GET_PTR(RUN_NEXT(run)))
+        {
+            stats->slot_bytes += ((RUN_SIZE - RUN_HDRSIZE) / SLOT_SIZE(class) - GET(RUN_USED(run))) * SLOT_SIZE(class);
+        }
+    }
+}
+
+/*
+ * checktree - helperfunction for checkheap(), checks the order and the priorities of the subtree rooted at node and
+ *             returns the number of blocks in it
+ */
+static int checktree(char *node)
 {
-    size_t hsize, halloc, fsize, falloc;
+    char *left;
+    char *right;
+
+    if (node == NULL)
+    {
+        return 0;
+    }
+
+    left = GET_PTR(TREE_LEFT(node));
+    right = GET_PTR(TREE_RIGHT(node));
+
+    if (GET_ALLOC(HDRP(node)) || GET_SIZE(HDRP(node)) < TREE_MIN)
+    {
+        printf("Error: %p does not belong in the tree\n", node);
+    }
+
+    if ((left != NULL && (!TREE_BEFORE(left, node) || TREE_PRIO(left) > TREE_PRIO(node))) ||
+        (right != NULL && (!TREE_BEFORE(node, right) || TREE_PRIO(right) > TREE_PRIO(node))))
+    {
+        printf("Error: the children of tree block %p are out of order\n", node);
+    }
+
+    return 1 + checktree(left) + checktree(right);
+}
 
-    char *next_block, *prev_block;
+/*
+ * printblock - helperfunction for checkheap(), only free blocks have a footer and links
+ */
+static void printblock(void *bp)
+{
+    unsigned int hsize, halloc, fsize, falloc;
 
     hsize = GET_SIZE(HDRP(bp));
     halloc = GET_ALLOC(HDRP(bp));
-    fsize = GET_SIZE(FTRP(bp));
-    falloc = GET_ALLOC(FTRP(bp));
-    next_block = (char *)GET(NEXT_PTR(bp));
-    prev_block = (char *)GET(PREV_PTR(bp));
 
     if (hsize == 0)
     {
@@ -640,25 +2758,35 @@ static void printblock(void *bp)
         return;
     }
 
-    printf("%p: header: [%d:%c] footer: [%d:%c] prev-block: [%p] next-block: [%p]\n", bp,
-           hsize, (halloc ? 'a' : 'f'),
-           fsize, (falloc ? 'a' : 'f'),
-           prev_block, next_block);
+    if (halloc)
+    {
+        printf("%p: header: [%u:a]\n", bp, hsize);
+        return;
+    }
+
+    fsize = GET_SIZE(FTRP(bp));
+    falloc = GET_ALLOC(FTRP(bp));
+
+    printf("%p: header: [%u:f] footer: [%u:%c] prev-block: [%p] next-block: [%p]\n", bp,
+           hsize, fsize, (falloc ? 'a' : 'f'),
+           GET_PTR(PREV_PTR(bp)), GET_PTR(NEXT_PTR(bp)));
 }
-*/
+
 /*
  * checkblock - helperfunction for checkheap()
  */
- /*
 static void checkblock(void *bp)
 {
-    if ((size_t)bp % 8)
+    if ((size_t)bp % ALIGNMENT)
     {
-        printf("Error: %p is not doubleword aligned\n", bp);
+        printf("Error: %p is not 16-byte aligned\n", bp);
     }
-    if (GET(HDRP(bp)) != GET(FTRP(bp)))
+
+    if (!GET_ALLOC(HDRP(bp)) && GET_SIZE(HDRP(bp)) != GET(FTRP(bp)))
     {
         printf("Error: header does not match footer\n");
     }
 }
-*/
\ No newline at end of file
+
+MM_BACKEND_EXT(MM_NAME, mm_init, mm_malloc, mm_free, mm_realloc, mm_checkheap, mm_malloc_batch, mm_free_batch,
+               mm_free_sized, mm_realloc_sized, mm_memalign, mm_heapstats)
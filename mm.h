@@ -4,6 +4,35 @@ extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern void mm_checkheap(int verbose);
+
+/* Allocate n blocks of size bytes at once, returns how many it got */
+extern int mm_malloc_batch(size_t size, void **ptrs, int n);
+/* Free n blocks at once, the order of ptrs is not kept */
+extern void mm_free_batch(void **ptrs, int n);
+/* Free a block given the size it was last allocated or reallocated with */
+extern void mm_free_sized(void *ptr, size_t size);
+/* Resize a block given its current size, the same as for mm_free_sized */
+extern void *mm_realloc_sized(void *ptr, size_t oldsize, size_t size);
+/* Allocate a block whose payload address is a multiple of align, a power of two */
+extern void *mm_memalign(size_t align, size_t size);
+
+/* Free block size classes of heapstats_t, class i counts blocks of 16<<i up to 32<<i bytes, the last the rest */
+#define HEAPSTATS_CLASSES 20
+
+/* The layout of the heap at one moment, as mm_heapstats finds it */
+typedef struct heapstats {
+    size_t heap_bytes;     /* size of the heap, without separately mapped blocks */
+    size_t free_bytes;     /* bytes in free blocks, tags included */
+    size_t free_blocks;    /* number of free blocks */
+    size_t largest_free;   /* size of the biggest free block */
+    size_t free_hist[HEAPSTATS_CLASSES]; /* number of free blocks in each size class */
+    size_t slot_bytes;     /* free slots of small object runs, if there are any */
+    size_t cached_bytes;   /* freed blocks that wait to be coalesced, if any */
+} heapstats_t;
+
+/* Walk the heap and fill in stats */
+extern void mm_heapstats(heapstats_t *stats);
 
 
 /* 
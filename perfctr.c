@@ -0,0 +1,164 @@
+/*
+ * perfctr.c - Count hardware events while a test function runs
+ *
+ * Each event has a counter of its own, so the events the CPU (or the
+ * virtual machine) doesn't support are simply left out. Only user
+ * space is counted, which perf_event_paranoid allows up to level 2.
+ * When the kernel has more events than hardware counters it takes
+ * turns counting them; the counts are then scaled up by the share of
+ * the time each event was counted.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "perfctr.h"
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+extern int verbose; /* -v option in mdriver.c */
+
+char *perf_event_names[PERF_NUM_EVENTS] = {
+    "cycles", "instrs", "L1d", "LLC", "dTLB", "branch"
+};
+
+#ifdef __linux__
+
+/* The perf type and config of each event */
+#define HW_CACHE(cache, op, result) \
+    ((cache) | ((op) << 8) | ((result) << 16))
+
+static struct {
+    unsigned int type;
+    unsigned long long config;
+} events[PERF_NUM_EVENTS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, HW_CACHE(PERF_COUNT_HW_CACHE_L1D,
+				  PERF_COUNT_HW_CACHE_OP_READ,
+				  PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HW_CACHE, HW_CACHE(PERF_COUNT_HW_CACHE_DTLB,
+				  PERF_COUNT_HW_CACHE_OP_READ,
+				  PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+static int fds[PERF_NUM_EVENTS]; /* counter of each event, -1 if none */
+static int initialized = 0;
+
+/*
+ * init_perf - open a (disabled) counter for each event of the
+ *     calling thread
+ */
+int init_perf(void)
+{
+    struct perf_event_attr attr;
+    int i, n = 0;
+
+    if (initialized) {
+	for (i = 0; i < PERF_NUM_EVENTS; i++)
+	    n += fds[i] >= 0;
+	return n;
+    }
+    initialized = 1;
+
+    for (i = 0; i < PERF_NUM_EVENTS; i++) {
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[i].type;
+	attr.config = events[i].config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+	    PERF_FORMAT_TOTAL_TIME_RUNNING;
+	fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	if (fds[i] < 0) {
+	    if (verbose)
+		printf("Can't count %s events: %s\n", perf_event_names[i],
+		       strerror(errno));
+	}
+	else
+	    n++;
+    }
+    return n;
+}
+
+/*
+ * close_perf - close the counters, which count the process that opened
+ *     them, so that a forked child opens counters of its own
+ */
+void close_perf(void)
+{
+    int i;
+
+    if (!initialized)
+	return;
+    for (i = 0; i < PERF_NUM_EVENTS; i++)
+	if (fds[i] >= 0)
+	    close(fds[i]);
+    initialized = 0;
+}
+
+/*
+ * fperf - count the events of one run of f(argp)
+ */
+void fperf(perf_test_funct f, void *argp, double *counts)
+{
+    unsigned long long value[3]; /* count, time enabled, time running */
+    int i;
+
+    init_perf();
+    for (i = 0; i < PERF_NUM_EVENTS; i++)
+	if (fds[i] >= 0)
+	    ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+    for (i = 0; i < PERF_NUM_EVENTS; i++)
+	if (fds[i] >= 0)
+	    ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+
+    f(argp);
+
+    for (i = 0; i < PERF_NUM_EVENTS; i++)
+	if (fds[i] >= 0)
+	    ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+    for (i = 0; i < PERF_NUM_EVENTS; i++) {
+	counts[i] = -1;
+	if (fds[i] < 0 || read(fds[i], value, sizeof(value)) != sizeof(value))
+	    continue;
+	if (value[2] == 0)          /* never got a hardware counter */
+	    continue;
+	counts[i] = (double)value[0];
+	if (value[2] < value[1])    /* multiplexed, scale up */
+	    counts[i] *= (double)value[1] / value[2];
+    }
+}
+
+#else /* !__linux__ */
+
+int init_perf(void)
+{
+    if (verbose)
+	printf("Can't count hardware events, perf_event_open is Linux only\n");
+    return 0;
+}
+
+void close_perf(void)
+{
+}
+
+void fperf(perf_test_funct f, void *argp, double *counts)
+{
+    int i;
+
+    f(argp);
+    for (i = 0; i < PERF_NUM_EVENTS; i++)
+	counts[i] = -1;
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,24 @@
+/*
+ * perfctr.h - Hardware event counts of a test function, measured with
+ *     the perf_event_open system call (Linux only)
+ */
+
+/* The events that are counted */
+enum {PERF_CYCLES, PERF_INSTRUCTIONS, PERF_L1D_MISSES, PERF_LLC_MISSES,
+      PERF_DTLB_MISSES, PERF_BRANCH_MISSES};
+#define PERF_NUM_EVENTS 6
+
+/* Short names of the events, for table headings */
+extern char *perf_event_names[PERF_NUM_EVENTS];
+
+typedef void (*perf_test_funct)(void *);
+
+/* Open the counters, returns how many of the events can be counted */
+int init_perf(void);
+
+/* Close the counters, a forked child then opens its own */
+void close_perf(void);
+
+/* Run f(argp) once and store the count of each event in counts,
+   or -1 for the events that can't be counted */
+void fperf(perf_test_funct f, void *argp, double *counts);
@@ -0,0 +1,30 @@
+/*
+ * rep2bin.c - Convert a text (.rep) malloc trace to the binary format
+ *
+ * usage: rep2bin <in.rep> <out>
+ *
+ * The binary trace can be given to mdriver in place of the .rep
+ * file; see trace.h for its layout.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "trace.h"
+
+int main(int argc, char **argv)
+{
+    trace_t *trace;
+
+    if (argc != 3) {
+	fprintf(stderr, "Usage: rep2bin <in.rep> <out>\n");
+	exit(1);
+    }
+
+    trace = read_trace("", argv[1]);
+    write_trace(trace, argv[2]);
+    printf("%s: %d records, %d ids, %lu bytes of requests\n", argv[2],
+	   trace->num_ops, trace->num_ids,
+	   (unsigned long)trace->num_ops * sizeof(traceop_t));
+    free_trace(trace);
+    exit(0);
+}
@@ -0,0 +1,413 @@
+/*
+ * trace.c - Read and write malloc trace files
+ *
+ * read_trace() accepts both formats: a file that starts with
+ * TRACE_MAGIC is a binary trace and is mapped read-only, anything
+ * else is parsed as a text (.rep) trace.
+ *
+ * Besides the "a id size", "r id size" and "f id" lines of the CS:APP
+ * format, a text trace can have batch requests: "A id count size"
+ * allocates count blocks of size bytes for the ids id..id+count-1
+ * and "F id count" frees them. "m id align size" allocates a block
+ * whose payload address is a multiple of align, a power of two.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+#define MAXLINE 1024 /* max string size */
+
+static trace_t *read_text_trace(trace_t *trace, FILE *tracefile, char *path);
+static trace_t *read_binary_trace(trace_t *trace, FILE *tracefile, char *path);
+static void check_binary_ops(trace_t *trace, char *path);
+static void trace_error(char *msg, char *path);
+static void trace_unix_error(char *msg, char *path);
+
+/*
+ * read_trace - read a trace file and store it in memory
+ */
+trace_t *read_trace(char *tracedir, char *filename)
+{
+    FILE *tracefile;
+    trace_t *trace;
+    char path[MAXLINE];
+    unsigned int magic;
+    int i;
+
+    /* Allocate the trace record */
+    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
+	trace_unix_error("malloc 1 failed in read_trace", "");
+    trace->map = NULL;
+    trace->map_size = 0;
+	
+    strcpy(path, tracedir);
+    strcat(path, filename);
+    if ((tracefile = fopen(path, "r")) == NULL)
+	trace_unix_error("Could not open tracefile", path);
+
+    /* Tell the formats apart by the first word */
+    if (fread(&magic, sizeof(magic), 1, tracefile) == 1 &&
+	magic == TRACE_MAGIC)
+	trace = read_binary_trace(trace, tracefile, path);
+    else {
+	rewind(tracefile);
+	trace = read_text_trace(trace, tracefile, path);
+    }
+    fclose(tracefile);
+
+    trace->num_reqs = 0;
+    for (i = 0; i < trace->num_ops; i += TRACE_RECS(&trace->ops[i]))
+	trace->num_reqs += TRACE_REQS(&trace->ops[i]);
+
+    /* We'll keep an array of pointers to the allocated blocks here... */
+    if ((trace->blocks = 
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	trace_unix_error("malloc 3 failed in read_trace", path);
+
+    /* ... along with the corresponding byte sizes of each block */
+    if ((trace->block_sizes = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	trace_unix_error("malloc 4 failed in read_trace", path);
+    
+    return trace;
+}
+
+/*
+ * read_text_trace - parse a .rep trace file
+ */
+static trace_t *read_text_trace(trace_t *trace, FILE *tracefile, char *path)
+{
+    char type[MAXLINE];
+    unsigned index, size, count;
+    unsigned max_index = 0;
+    unsigned op_index, lines;
+    int num_lines;
+    traceop_t *ops;
+
+    /* Read the trace file header */
+    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
+    fscanf(tracefile, "%d", &(trace->num_ids));     
+    fscanf(tracefile, "%d", &num_lines);     
+    fscanf(tracefile, "%d", &(trace->weight));        /* not used */
+    if (trace->num_ids - 1 > TRACE_MAX_ID)
+	trace_error("Too many ids in tracefile", path);
+    if (num_lines < 0)
+	trace_error("Bad header in tracefile", path);
+    
+    /* 
+     * We'll store each request line in the trace in this array, with
+     * room for an ARG record after every line
+     */
+    if ((trace->ops = 
+	 (traceop_t *)malloc(2 * (size_t)num_lines * sizeof(traceop_t))) == NULL &&
+	num_lines > 0)
+	trace_unix_error("malloc 2 failed in read_trace", path);
+
+    /* read every request line in the trace file */
+    index = 0;
+    op_index = 0;
+    lines = 0;
+    while (fscanf(tracefile, "%s", type) != EOF) {
+	switch(type[0]) {
+	case 'a':
+	    fscanf(tracefile, "%u %u", &index, &size);
+	    trace->ops[op_index].type = ALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'r':
+	    fscanf(tracefile, "%u %u", &index, &size);
+	    trace->ops[op_index].type = REALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'f':
+	    fscanf(tracefile, "%ud", &index);
+	    trace->ops[op_index].type = FREE;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = 0;
+	    break;
+	case 'A':
+	    fscanf(tracefile, "%u %u %u", &index, &count, &size);
+	    if (count < 1)
+		trace_error("Empty batch in tracefile", path);
+	    trace->ops[op_index].type = ALLOC_BATCH;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    op_index++;
+	    trace->ops[op_index].type = ARG;
+	    trace->ops[op_index].index = 0;
+	    trace->ops[op_index].size = count;
+	    index += count - 1;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'm':
+	    fscanf(tracefile, "%u %u %u", &index, &count, &size);
+	    if (count == 0 || (count & (count - 1)))
+		trace_error("Alignment is not a power of two in tracefile", path);
+	    trace->ops[op_index].type = ALLOC_ALIGNED;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    op_index++;
+	    trace->ops[op_index].type = ARG;
+	    trace->ops[op_index].index = 0;
+	    trace->ops[op_index].size = count;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'F':
+	    fscanf(tracefile, "%u %u", &index, &count);
+	    if (count < 1)
+		trace_error("Empty batch in tracefile", path);
+	    trace->ops[op_index].type = FREE_BATCH;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = count;
+	    break;
+	default:
+	    printf("Bogus type character (%c) in tracefile %s\n", 
+		   type[0], path);
+	    exit(1);
+	}
+	op_index++;
+	lines++;
+	
+    }
+    assert(max_index == trace->num_ids - 1);
+    assert((unsigned)num_lines == lines);
+
+    /* Give back the room of the ARG records the trace did not need */
+    trace->num_ops = op_index;
+    if (op_index > 0 &&
+	(ops = (traceop_t *)realloc(trace->ops, op_index * sizeof(traceop_t))) != NULL)
+	trace->ops = ops;
+    
+    return trace;
+}
+
+/* A request of a version 2 binary trace, which kept a count in each */
+typedef struct {
+    unsigned int type  : 4;
+    unsigned int index : 28;
+    unsigned int size;
+    unsigned int count;
+} traceop_v2_t;
+
+/*
+ * read_binary_trace - map a binary trace file; its requests are used
+ *     in place, those of a version 2 file are copied. A version 1 file
+ *     has the same records and no batches, so it is mapped as well.
+ */
+static trace_t *read_binary_trace(trace_t *trace, FILE *tracefile, char *path)
+{
+    struct stat st;
+    trace_hdr_t *hdr;
+    traceop_v2_t *old;
+    int i, n;
+
+    if (fstat(fileno(tracefile), &st) < 0)
+	trace_unix_error("Could not stat tracefile", path);
+    if ((size_t)st.st_size < sizeof(trace_hdr_t))
+	trace_error("Truncated binary tracefile", path);
+
+    trace->map_size = st.st_size;
+    trace->map = mmap(NULL, trace->map_size, PROT_READ, MAP_PRIVATE,
+		      fileno(tracefile), 0);
+    if (trace->map == MAP_FAILED)
+	trace_unix_error("Could not map tracefile", path);
+
+    hdr = (trace_hdr_t *)trace->map;
+    if (hdr->num_ids < 0 || hdr->num_ids - 1 > TRACE_MAX_ID || hdr->num_ops < 0)
+	trace_error("Bad header in binary tracefile", path);
+    trace->sugg_heapsize = hdr->sugg_heapsize;
+    trace->num_ids = hdr->num_ids;
+    trace->weight = hdr->weight;
+    if (hdr->version == 2) {
+	if (trace->map_size != sizeof(trace_hdr_t) +
+	    (size_t)hdr->num_ops * sizeof(traceop_v2_t))
+	    trace_error("Binary tracefile has the wrong length", path);
+	old = (traceop_v2_t *)(hdr + 1);
+	for (i = 0, n = 0; i < hdr->num_ops; i++)
+	    n += TRACE_RECS(&old[i]);
+	if ((trace->ops = (traceop_t *)malloc(n * sizeof(traceop_t))) == NULL && n > 0)
+	    trace_unix_error("malloc 2 failed in read_trace", path);
+	for (i = 0, n = 0; i < hdr->num_ops; i++) {
+	    trace->ops[n].type = old[i].type;
+	    trace->ops[n].index = old[i].index;
+	    trace->ops[n].size = (old[i].type == FREE_BATCH) ? old[i].count : old[i].size;
+	    if (TRACE_RECS(&old[i]) == 2) {
+		n++;
+		trace->ops[n].type = ARG;
+		trace->ops[n].index = 0;
+		trace->ops[n].size = old[i].count;
+	    }
+	    n++;
+	}
+	trace->num_ops = n;
+	munmap(trace->map, trace->map_size);
+	trace->map = NULL;
+	trace->map_size = 0;
+	check_binary_ops(trace, path);
+	return trace;
+    }
+    if (hdr->version != 1 && hdr->version != TRACE_VERSION)
+	trace_error("Unsupported binary tracefile version", path);
+    if (trace->map_size != sizeof(trace_hdr_t) + 
+	(size_t)hdr->num_ops * sizeof(traceop_t))
+	trace_error("Binary tracefile has the wrong length", path);
+
+    /* Ask for the whole file up front, replay walks all of it */
+    madvise(trace->map, trace->map_size, MADV_WILLNEED);
+
+    trace->num_ops = hdr->num_ops;
+    trace->ops = (traceop_t *)(hdr + 1);
+    check_binary_ops(trace, path);
+    return trace;
+}
+
+/*
+ * check_binary_ops - make sure every request of a binary trace is one
+ *     the driver can replay: a known type, the ARG record it needs, a
+ *     batch of at least one id, a power of two alignment, and ids below
+ *     num_ids. The text parser gets these from the format, a corrupt or
+ *     truncated binary file would have the driver write past its blocks
+ *     array. Requests are numbered by their first record.
+ */
+static void check_binary_ops(trace_t *trace, char *path)
+{
+    char msg[MAXLINE];
+    traceop_t *op;
+    int i;
+
+    for (i = 0; i < trace->num_ops; i += TRACE_RECS(op)) {
+	op = &trace->ops[i];
+	if (op->type >= NUM_OPTYPES)
+	    sprintf(msg, "Bogus type %u of request %d in binary tracefile",
+		    op->type, i);
+	else if (TRACE_RECS(op) == 2 &&
+		 (i + 1 == trace->num_ops || op[1].type != ARG))
+	    sprintf(msg, "Request %d has no ARG record in binary tracefile", i);
+	else if ((op->type == ALLOC_BATCH || op->type == FREE_BATCH) &&
+		 TRACE_COUNT(op) < 1)
+	    sprintf(msg, "Empty batch in request %d of binary tracefile", i);
+	else if (op->type == ALLOC_ALIGNED &&
+		 (TRACE_COUNT(op) == 0 || (TRACE_COUNT(op) & (TRACE_COUNT(op) - 1))))
+	    sprintf(msg, "Alignment of request %d is not a power of two in "
+		    "binary tracefile", i);
+	else if ((size_t)op->index + TRACE_REQS(op) > (size_t)trace->num_ids)
+	    sprintf(msg, "Id of request %d out of range in binary tracefile", i);
+	else
+	    continue;
+	trace_error(msg, path);
+    }
+}
+
+/*
+ * write_trace - store a trace in the binary format
+ */
+void write_trace(trace_t *trace, char *path)
+{
+    FILE *tracefile;
+    trace_hdr_t hdr;
+
+    if ((tracefile = fopen(path, "w")) == NULL)
+	trace_unix_error("Could not create tracefile", path);
+
+    hdr.magic = TRACE_MAGIC;
+    hdr.version = TRACE_VERSION;
+    hdr.sugg_heapsize = trace->sugg_heapsize;
+    hdr.num_ids = trace->num_ids;
+    hdr.num_ops = trace->num_ops;
+    hdr.weight = trace->weight;
+    if (fwrite(&hdr, sizeof(hdr), 1, tracefile) != 1 ||
+	fwrite(trace->ops, sizeof(traceop_t), trace->num_ops, tracefile) !=
+	(size_t)trace->num_ops)
+	trace_unix_error("Could not write tracefile", path);
+    if (fclose(tracefile) != 0)
+	trace_unix_error("Could not write tracefile", path);
+}
+
+/*
+ * write_text_trace - store a trace in the text (.rep) format
+ */
+void write_text_trace(trace_t *trace, char *path)
+{
+    FILE *tracefile;
+    traceop_t *op;
+    int i, lines;
+
+    if ((tracefile = fopen(path, "w")) == NULL)
+	trace_unix_error("Could not create tracefile", path);
+
+    /* The header counts lines, an ARG record is not one */
+    for (i = 0, lines = 0; i < trace->num_ops; i += TRACE_RECS(&trace->ops[i]))
+	lines++;
+    fprintf(tracefile, "%d\n%d\n%d\n%d\n", trace->sugg_heapsize,
+	    trace->num_ids, lines, trace->weight);
+    for (i = 0; i < trace->num_ops; i += TRACE_RECS(op)) {
+	op = &trace->ops[i];
+	switch (op->type) {
+	case ALLOC:
+	    fprintf(tracefile, "a %u %u\n", op->index, op->size);
+	    break;
+	case REALLOC:
+	    fprintf(tracefile, "r %u %u\n", op->index, op->size);
+	    break;
+	case FREE:
+	    fprintf(tracefile, "f %u\n", op->index);
+	    break;
+	case ALLOC_BATCH:
+	    fprintf(tracefile, "A %u %u %u\n", op->index, TRACE_COUNT(op), op->size);
+	    break;
+	case FREE_BATCH:
+	    fprintf(tracefile, "F %u %u\n", op->index, TRACE_COUNT(op));
+	    break;
+	case ALLOC_ALIGNED:
+	    fprintf(tracefile, "m %u %u %u\n", op->index, TRACE_COUNT(op), op->size);
+	    break;
+	}
+    }
+    if (ferror(tracefile) || fclose(tracefile) != 0)
+	trace_unix_error("Could not write tracefile", path);
+}
+
+/*
+ * free_trace - Free the trace record and the three arrays it points
+ *              to, all of which were allocated in read_trace().
+ */
+void free_trace(trace_t *trace)
+{
+    if (trace->map != NULL)   /* unmap or free the requests... */
+	munmap(trace->map, trace->map_size);
+    else
+	free(trace->ops);
+    free(trace->blocks);      /* ... the other two arrays... */
+    free(trace->block_sizes);
+    free(trace);              /* and the trace record itself... */
+}
+
+/* 
+ * trace_error - Report a malformed tracefile
+ */
+static void trace_error(char *msg, char *path)
+{
+    printf("%s: %s\n", msg, path);
+    exit(1);
+}
+
+/* 
+ * trace_unix_error - Report a Unix-style error on a tracefile
+ */
+static void trace_unix_error(char *msg, char *path)
+{
+    printf("%s %s: %s\n", msg, path, strerror(errno));
+    exit(1);
+}
@@ -0,0 +1,74 @@
+/*
+ * trace.h - Malloc trace files, in the text (.rep) and binary formats
+ *
+ * A binary trace is a trace_hdr_t followed by num_ops traceop_t
+ * records, exactly as they are laid out in memory, so it can be
+ * mapped and replayed without parsing. Every record is 8 bytes: a
+ * free batch keeps its count in size, an alloc batch and an aligned
+ * alloc are followed by an ARG record that holds their count. Binary
+ * traces are written and read on the same kind of machine; the magic
+ * number tells a trace written with the other byte order apart.
+ */
+#include <stddef.h>
+
+/*
+ * Request types, a batch allocates or frees count consecutive ids and
+ * an aligned alloc keeps its alignment in count. ARG is not a request,
+ * it is the record after an alloc batch or an aligned alloc.
+ */
+enum {ALLOC, FREE, REALLOC, ALLOC_BATCH, FREE_BATCH, ALLOC_ALIGNED, ARG};
+#define NUM_OPTYPES 6   /* number of request types */
+
+/* Characterizes a single trace operation (allocator request) */
+typedef struct {
+    unsigned int type  : 4;  /* type of request */
+    unsigned int index : 28; /* index for free() to use later, first of a batch */
+    unsigned int size;       /* byte size of alloc/realloc request, ids of a
+                              * free batch, count of the request before an ARG */
+} traceop_t;
+
+/* Number of records request op takes, 2 if an ARG record follows it */
+#define TRACE_RECS(op) \
+    (((op)->type == ALLOC_BATCH || (op)->type == ALLOC_ALIGNED) ? 2 : 1)
+
+/* Ids of a batch, alignment of an aligned alloc, else 1 */
+#define TRACE_COUNT(op) \
+    (TRACE_RECS(op) == 2 ? (op)[1].size : (op)->type == FREE_BATCH ? (op)->size : 1)
+
+/* Number of blocks request op asks for */
+#define TRACE_REQS(op) \
+    (((op)->type == ALLOC_BATCH || (op)->type == FREE_BATCH) ? TRACE_COUNT(op) : 1)
+
+/* Largest id a trace can use */
+#define TRACE_MAX_ID ((1 << 28) - 1)
+
+/* Header of a binary trace file */
+#define TRACE_MAGIC   0x4c424d54 /* "TMBL" when stored little endian */
+#define TRACE_VERSION 3         /* 1 had no batches, 2 had a count in every record */
+typedef struct {
+    unsigned int magic;     /* TRACE_MAGIC */
+    unsigned int version;   /* TRACE_VERSION */
+    int sugg_heapsize;      /* suggested heap size (unused) */
+    int num_ids;            /* number of alloc/realloc ids */
+    int num_ops;            /* number of records, ARG records count too */
+    int weight;             /* weight for this trace (unused) */
+} trace_hdr_t;
+
+/* Holds the information for one trace file*/
+typedef struct {
+    int sugg_heapsize;   /* suggested heap size (unused) */
+    int num_ids;         /* number of alloc/realloc ids */
+    int num_ops;         /* number of records in ops, ARG records count too */
+    int num_reqs;        /* number of blocks requested, batches count each */
+    int weight;          /* weight for this trace (unused) */
+    traceop_t *ops;      /* array of requests */
+    char **blocks;       /* array of ptrs returned by malloc/realloc... */
+    size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    void *map;           /* mapping of a binary trace file (else NULL)... */
+    size_t map_size;     /* ... and its length */
+} trace_t;
+
+trace_t *read_trace(char *tracedir, char *filename);
+void write_trace(trace_t *trace, char *path);
+void write_text_trace(trace_t *trace, char *path);
+void free_trace(trace_t *trace);
@@ -0,0 +1,540 @@
+/*
+ * tracegen.c - Generate synthetic malloc traces from parameterized models
+ *
+ * usage: tracegen [options] <out>
+ *
+ * The trace is written in the text format if the name of <out> ends
+ * in .rep, and in the binary format (see trace.h) otherwise.
+ *
+ * A trace is a steady state churn: every request allocates a new
+ * object, unless the object that dies first is past its lifetime or
+ * the live heap has reached its target size, in that case that object
+ * is freed. Object sizes come from a log-normal, Zipf or bimodal
+ * distribution, lifetimes (counted in requests) from an exponential
+ * or Pareto distribution. Some objects grow by a chain of reallocs,
+ * like a vector that is appended to. Objects can also be allocated
+ * and freed in batches of the same size, with the ALLOC_BATCH and
+ * FREE_BATCH requests, or ask for an aligned payload with
+ * ALLOC_ALIGNED. The trace can be split into
+ * phases, at the start of each one half of the live heap is freed and
+ * the sizes are scaled by a random factor. All live objects are freed
+ * at the end, so a trace starts and ends with an empty heap.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "trace.h"
+
+/* Size distributions */
+enum {LOGNORMAL, ZIPF, BIMODAL};
+
+/* Lifetime distributions */
+enum {EXPONENTIAL, PARETO};
+
+#define PARETO_ALPHA 1.5   /* shape of the Pareto lifetimes, heavy tailed */
+#define PHASE_SCALE  4.0   /* sizes change by a factor in [1/4, 4] per phase */
+#define MIN_SIZE     1     /* smallest request (bytes) */
+
+/* The parameters of the models, set from the command line */
+typedef struct {
+    int ops;                /* requests before the final frees */
+    int sizes;              /* size distribution */
+    double median;          /* median size, or the size of rank 1 for Zipf */
+    double sigma;           /* log-normal shape */
+    double zipf_s;          /* Zipf exponent */
+    int zipf_ranks;         /* number of distinct Zipf sizes */
+    double large_median;    /* median of the large mode of bimodal */
+    double large_frac;      /* fraction of bimodal requests that are large */
+    int lifetimes;          /* lifetime distribution */
+    double mean_life;       /* mean lifetime (requests) */
+    size_t target;          /* live heap target (bytes) */
+    size_t max_size;        /* biggest request (bytes) */
+    int phases;             /* number of phases */
+    double chain_prob;      /* probability that an object grows by reallocs */
+    double chain_len;       /* mean number of reallocs of a growing object */
+    int batch;              /* objects allocated and freed together */
+    double align_frac;      /* fraction of single objects that are aligned */
+    unsigned int align;     /* their alignment (bytes) */
+    unsigned long seed;     /* random seed */
+} model_t;
+
+/* A live object, kept in a heap ordered by the time it dies */
+typedef struct {
+    double death;           /* request count at which the object dies */
+    unsigned int id;        /* its id in the trace, the first of a batch */
+    unsigned int count;     /* number of objects of the batch, else 1 */
+} object_t;
+
+/* The trace being built */
+static traceop_t *ops;      /* requests so far */
+static int num_ops;         /* number of records so far, ARG records count too */
+static int max_ops;         /* room in ops */
+static int num_reqs;        /* number of requests so far */
+static unsigned int num_ids;/* number of ids so far */
+static unsigned int *sizes; /* current size of every id */
+static int max_sizes;       /* room in sizes */
+static unsigned char *grows;/* reallocs left for every id, 0 if none */
+static int max_grows;       /* room in grows */
+
+/* The live objects */
+static object_t *live;      /* heap of the live objects */
+static int num_live;        /* number of live objects */
+static size_t live_bytes;   /* total size of the live objects */
+static size_t peak_bytes;   /* largest live_bytes */
+static unsigned int *chains;/* ids that may still grow */
+static int num_chains;      /* number of ids in chains */
+
+static unsigned long long rng_state;
+
+/* Function prototypes */
+static void generate(model_t *m);
+static void add_op(int type, unsigned int id, unsigned int size,
+		   unsigned int count);
+static void push_live(double death, unsigned int id, unsigned int count);
+static object_t pop_live(void);
+static void free_first(void);
+static unsigned int sample_size(model_t *m, double scale);
+static double sample_life(model_t *m);
+static double uniform(void);
+static double normal(void);
+static void *grow(void *p, int *max, int want, size_t elem);
+static void usage(void);
+
+int main(int argc, char **argv)
+{
+    model_t m;
+    trace_t trace;
+    size_t len;
+    char c;
+
+    /* Defaults: a mixed heap of small objects that churns at 4 MB */
+    m.ops = 100000;
+    m.sizes = LOGNORMAL;
+    m.median = 64;
+    m.sigma = 1.0;
+    m.zipf_s = 1.2;
+    m.zipf_ranks = 256;
+    m.large_median = 4096;
+    m.large_frac = 0.1;
+    m.lifetimes = EXPONENTIAL;
+    m.mean_life = 10000;
+    m.target = 4 << 20;
+    m.max_size = 1 << 20;
+    m.phases = 1;
+    m.chain_prob = 0;
+    m.chain_len = 8;
+    m.batch = 1;
+    m.align_frac = 0;
+    m.align = 64;
+    m.seed = 1;
+
+    while ((c = getopt(argc, argv, "n:d:m:g:z:k:M:p:l:T:L:X:P:r:c:B:a:A:S:h")) != EOF) {
+	switch (c) {
+	case 'n': /* Number of requests before the final frees */
+	    m.ops = atoi(optarg);
+	    break;
+	case 'd': /* Size distribution */
+	    if (!strcmp(optarg, "lognormal"))
+		m.sizes = LOGNORMAL;
+	    else if (!strcmp(optarg, "zipf"))
+		m.sizes = ZIPF;
+	    else if (!strcmp(optarg, "bimodal"))
+		m.sizes = BIMODAL;
+	    else {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'm': /* Median size */
+	    m.median = atof(optarg);
+	    break;
+	case 'g': /* Log-normal shape */
+	    m.sigma = atof(optarg);
+	    break;
+	case 'z': /* Zipf exponent */
+	    m.zipf_s = atof(optarg);
+	    break;
+	case 'k': /* Number of distinct Zipf sizes */
+	    m.zipf_ranks = atoi(optarg);
+	    break;
+	case 'M': /* Median of the large bimodal mode */
+	    m.large_median = atof(optarg);
+	    break;
+	case 'p': /* Fraction of large bimodal requests */
+	    m.large_frac = atof(optarg);
+	    break;
+	case 'l': /* Lifetime distribution */
+	    if (!strcmp(optarg, "exp"))
+		m.lifetimes = EXPONENTIAL;
+	    else if (!strcmp(optarg, "pareto"))
+		m.lifetimes = PARETO;
+	    else {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'T': /* Mean lifetime */
+	    m.mean_life = atof(optarg);
+	    break;
+	case 'L': /* Live heap target */
+	    m.target = strtoul(optarg, NULL, 0);
+	    break;
+	case 'X': /* Biggest request */
+	    m.max_size = strtoul(optarg, NULL, 0);
+	    break;
+	case 'P': /* Number of phases */
+	    m.phases = atoi(optarg);
+	    break;
+	case 'r': /* Probability of a realloc chain */
+	    m.chain_prob = atof(optarg);
+	    break;
+	case 'c': /* Mean length of a realloc chain */
+	    m.chain_len = atof(optarg);
+	    break;
+	case 'B': /* Objects per batch */
+	    m.batch = atoi(optarg);
+	    break;
+	case 'a': /* Fraction of aligned objects */
+	    m.align_frac = atof(optarg);
+	    break;
+	case 'A': /* Their alignment */
+	    m.align = strtoul(optarg, NULL, 0);
+	    break;
+	case 'S': /* Random seed */
+	    m.seed = strtoul(optarg, NULL, 0);
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (optind != argc - 1 || m.ops < 1 || m.phases < 1 || m.zipf_ranks < 1 ||
+	m.median < MIN_SIZE || m.max_size < MIN_SIZE || m.mean_life <= 0 ||
+	m.batch < 1 || m.align == 0 || (m.align & (m.align - 1))) {
+	usage();
+	exit(1);
+    }
+
+    generate(&m);
+
+    trace.sugg_heapsize = peak_bytes;
+    trace.num_ids = num_ids;
+    trace.num_ops = num_ops;
+    trace.weight = 1;
+    trace.ops = ops;
+
+    len = strlen(argv[optind]);
+    if (len > 4 && !strcmp(argv[optind] + len - 4, ".rep"))
+	write_text_trace(&trace, argv[optind]);
+    else
+	write_trace(&trace, argv[optind]);
+
+    printf("%s: %d ops, %d ids, %lu KB peak live heap\n", argv[optind],
+	   num_reqs, trace.num_ids, (unsigned long)(peak_bytes >> 10));
+    exit(0);
+}
+
+/*
+ * generate - build the trace of model m
+ */
+static void generate(model_t *m)
+{
+    unsigned int id;
+    unsigned int size, chain;
+    double scale = 1.0;
+    int phase_len = m->ops / m->phases;
+    int phase = 0;
+    int step, i;
+
+    rng_state = m->seed * 0x9e3779b97f4a7c15ULL + 1;
+
+    for (step = 0; step < m->ops; step++) {
+	/* A new phase frees half the live heap and scales the sizes */
+	if (phase_len > 0 && step == (phase + 1) * phase_len && phase + 1 < m->phases) {
+	    size_t keep = live_bytes / 2;
+
+	    phase++;
+	    while (live_bytes > keep)
+		free_first();
+	    scale = exp((2 * uniform() - 1) * log(PHASE_SCALE));
+	}
+
+	/* Grow an object of a realloc chain */
+	if (num_chains > 0 && uniform() < 0.5) {
+	    i = (int)(uniform() * num_chains);
+	    chain = chains[i];
+	    if (grows[chain] == 0) {
+		chains[i] = chains[--num_chains];
+		step--;
+		continue;
+	    }
+	    size = sizes[chain] + sizes[chain] / 2 + MIN_SIZE;
+	    if (size > m->max_size)
+		size = m->max_size;
+	    live_bytes += size - sizes[chain];
+	    if (live_bytes > peak_bytes)
+		peak_bytes = live_bytes;
+	    sizes[chain] = size;
+	    add_op(REALLOC, chain, size, 1);
+	    if (--grows[chain] == 0 || size == m->max_size) {
+		grows[chain] = 0;
+		chains[i] = chains[--num_chains];
+	    }
+	    continue;
+	}
+
+	/* Free the object that dies first, if it is time or the heap is full */
+	if (num_live > 0 && (live[0].death <= step || live_bytes >= m->target)) {
+	    free_first();
+	    continue;
+	}
+
+	/* Otherwise allocate a new object, or a batch of them */
+	size = sample_size(m, scale);
+	id = num_ids;
+	num_ids += m->batch;
+	sizes = grow(sizes, &max_sizes, num_ids, sizeof(unsigned int));
+	grows = grow(grows, &max_grows, num_ids, sizeof(unsigned char));
+	for (i = id; i < (int)num_ids; i++) {
+	    sizes[i] = size;
+	    grows[i] = 0;
+	}
+	live_bytes += (size_t)size * m->batch;
+	if (live_bytes > peak_bytes)
+	    peak_bytes = live_bytes;
+	if (m->batch == 1 && m->align_frac > 0 && uniform() < m->align_frac)
+	    add_op(ALLOC_ALIGNED, id, size, m->align);
+	else
+	    add_op(m->batch > 1 ? ALLOC_BATCH : ALLOC, id, size, m->batch);
+	push_live(step + sample_life(m), id, m->batch);
+
+	if (m->batch == 1 && uniform() < m->chain_prob) {
+	    /* geometric number of reallocs, with mean chain_len */
+	    double len = ceil(log(1 - uniform()) / log(1 - 1 / (m->chain_len + 1)));
+
+	    grows[id] = len > 255 ? 255 : (len < 1 ? 1 : (unsigned char)len);
+	    i = num_chains;
+	    chains = realloc(chains, (num_chains + 1) * sizeof(unsigned int));
+	    if (chains == NULL) {
+		fprintf(stderr, "ERROR: out of memory\n");
+		exit(1);
+	    }
+	    chains[i] = id;
+	    num_chains++;
+	}
+    }
+
+    /* Leave an empty heap behind */
+    while (num_live > 0)
+	free_first();
+}
+
+/*
+ * add_op - append a request to the trace, count is the number of ids
+ *     of a batch or the alignment of an aligned alloc
+ */
+static void add_op(int type, unsigned int id, unsigned int size,
+		   unsigned int count)
+{
+    ops = grow(ops, &max_ops, num_ops + 2, sizeof(traceop_t));
+    ops[num_ops].type = type;
+    ops[num_ops].index = id;
+    ops[num_ops].size = (type == FREE_BATCH) ? count : size;
+    if (TRACE_RECS(&ops[num_ops]) == 2) {
+	ops[num_ops + 1].type = ARG;
+	ops[num_ops + 1].index = 0;
+	ops[num_ops + 1].size = count;
+    }
+    if (id + TRACE_REQS(&ops[num_ops]) - 1 > TRACE_MAX_ID) {
+	fprintf(stderr, "ERROR: too many ids for a trace\n");
+	exit(1);
+    }
+    num_ops += TRACE_RECS(&ops[num_ops]);
+    num_reqs++;
+}
+
+/*
+ * push_live, pop_live - add an object to and take the first one to
+ *     die off the heap of live objects
+ */
+static void push_live(double death, unsigned int id, unsigned int count)
+{
+    static int max_live = 0;
+    int i = num_live++;
+
+    live = grow(live, &max_live, num_live, sizeof(object_t));
+    while (i > 0 && live[(i - 1) / 2].death > death) {
+	live[i] = live[(i - 1) / 2];
+	i = (i - 1) / 2;
+    }
+    live[i].death = death;
+    live[i].id = id;
+    live[i].count = count;
+}
+
+static object_t pop_live(void)
+{
+    object_t first = live[0];
+    object_t last = live[--num_live];
+    int i = 0, child;
+
+    while ((child = 2 * i + 1) < num_live) {
+	if (child + 1 < num_live && live[child + 1].death < live[child].death)
+	    child++;
+	if (last.death <= live[child].death)
+	    break;
+	live[i] = live[child];
+	i = child;
+    }
+    live[i] = last;
+    return first;
+}
+
+/*
+ * free_first - free the live object (or batch) that dies first, which
+ *     ends its realloc chain
+ */
+static void free_first(void)
+{
+    object_t obj = pop_live();
+
+    if (obj.count > 1) {
+	live_bytes -= (size_t)sizes[obj.id] * obj.count;
+	add_op(FREE_BATCH, obj.id, 0, obj.count);
+	return;
+    }
+    live_bytes -= sizes[obj.id];
+    grows[obj.id] = 0;
+    add_op(FREE, obj.id, 0, 1);
+}
+
+/*
+ * sample_size - draw a request size from the size distribution, with
+ *     the median scaled by scale
+ */
+static unsigned int sample_size(model_t *m, double scale)
+{
+    static double *zipf_cdf = NULL;
+    double size;
+    int lo, hi, mid;
+
+    switch (m->sizes) {
+    case ZIPF:
+	/* rank r has weight 1/r^s and size r * median */
+	if (zipf_cdf == NULL) {
+	    if ((zipf_cdf = malloc(m->zipf_ranks * sizeof(double))) == NULL) {
+		fprintf(stderr, "ERROR: out of memory\n");
+		exit(1);
+	    }
+	    for (lo = 0; lo < m->zipf_ranks; lo++)
+		zipf_cdf[lo] = (lo ? zipf_cdf[lo - 1] : 0) + pow(lo + 1, -m->zipf_s);
+	}
+	size = uniform() * zipf_cdf[m->zipf_ranks - 1];
+	for (lo = 0, hi = m->zipf_ranks - 1; lo < hi; ) {
+	    mid = (lo + hi) / 2;
+	    if (zipf_cdf[mid] < size)
+		lo = mid + 1;
+	    else
+		hi = mid;
+	}
+	size = (lo + 1) * m->median * scale;
+	break;
+    case BIMODAL:
+	if (uniform() < m->large_frac)
+	    size = m->large_median * scale * exp(m->sigma * normal());
+	else
+	    size = m->median * scale * exp(m->sigma * normal());
+	break;
+    default:
+	size = m->median * scale * exp(m->sigma * normal());
+	break;
+    }
+
+    if (size < MIN_SIZE)
+	return MIN_SIZE;
+    if (size > m->max_size)
+	return m->max_size;
+    return (unsigned int)size;
+}
+
+/*
+ * sample_life - draw a lifetime (in requests) from the lifetime
+ *     distribution
+ */
+static double sample_life(model_t *m)
+{
+    if (m->lifetimes == PARETO)
+	/* scale chosen so the mean is mean_life */
+	return m->mean_life * (PARETO_ALPHA - 1) / PARETO_ALPHA *
+	    pow(1 - uniform(), -1 / PARETO_ALPHA);
+    return -m->mean_life * log(1 - uniform());
+}
+
+/*
+ * uniform - return a random number in [0, 1), xorshift64*
+ */
+static double uniform(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return ((rng_state * 0x2545f4914f6cdd1dULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * normal - return a standard normal random number (Box-Muller)
+ */
+static double normal(void)
+{
+    return sqrt(-2 * log(1 - uniform())) * cos(2 * M_PI * uniform());
+}
+
+/*
+ * grow - make room for want elements of size elem in array p, which
+ *     has room for *max of them
+ */
+static void *grow(void *p, int *max, int want, size_t elem)
+{
+    if (want <= *max)
+	return p;
+    *max = (*max < 1024 ? 1024 : *max);
+    while (*max < want)
+	*max *= 2;
+    if ((p = realloc(p, *max * elem)) == NULL) {
+	fprintf(stderr, "ERROR: out of memory\n");
+	exit(1);
+    }
+    return p;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: tracegen [-h] [options] <out>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-n <ops>    Requests before the final frees (100000).\n");
+    fprintf(stderr, "\t-d <dist>   Sizes: lognormal, zipf or bimodal (lognormal).\n");
+    fprintf(stderr, "\t-m <bytes>  Median size, Zipf size unit (64).\n");
+    fprintf(stderr, "\t-g <sigma>  Log-normal shape, also of both bimodal modes (1.0).\n");
+    fprintf(stderr, "\t-z <s>      Zipf exponent (1.2).\n");
+    fprintf(stderr, "\t-k <n>      Number of distinct Zipf sizes (256).\n");
+    fprintf(stderr, "\t-M <bytes>  Median of the large bimodal mode (4096).\n");
+    fprintf(stderr, "\t-p <frac>   Fraction of large bimodal requests (0.1).\n");
+    fprintf(stderr, "\t-l <dist>   Lifetimes: exp or pareto (exp).\n");
+    fprintf(stderr, "\t-T <ops>    Mean lifetime in requests (10000).\n");
+    fprintf(stderr, "\t-L <bytes>  Live heap target (4194304).\n");
+    fprintf(stderr, "\t-X <bytes>  Biggest request (1048576).\n");
+    fprintf(stderr, "\t-P <n>      Number of phases (1).\n");
+    fprintf(stderr, "\t-r <prob>   Probability an object grows by reallocs (0).\n");
+    fprintf(stderr, "\t-c <n>      Mean number of reallocs of a growing object (8).\n");
+    fprintf(stderr, "\t-B <n>      Allocate and free objects in batches of n (1).\n");
+    fprintf(stderr, "\t-a <frac>   Fraction of single objects that are aligned (0).\n");
+    fprintf(stderr, "\t-A <bytes>  Their alignment, a power of two (64).\n");
+    fprintf(stderr, "\t-S <seed>   Random seed (1).\n");
+    fprintf(stderr, "If <out> ends in .rep the text format is written, else the binary one.\n");
+}